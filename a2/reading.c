@@ -1,15 +1,55 @@
 #include "reading.h"
+#include "dictfile.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-/* Read all words from filename and return them in a 2D array. */
+/* The compiled dictionary the current word list points into, if any. */
+static struct dict_file compiled;
+
+/* Return the words of the compiled dictionary filename in a 2D array.
+   The words are not copied; they point straight into the mapped file.
+   They come sorted by length, but the words of any one length are in the
+   order of the word list the dictionary was compiled from, so a list
+   pruned to one length is the same as from the text file. A dictionary
+   with a word or a word count over the limits of the text path is
+   refused rather than read differently. */
+static char **map_words(char *filename) {
+    char **words;
+
+    if (dict_open(&compiled, filename) < 0) {
+        exit(1);
+    }
+    if (compiled.header->max_len > MAX_WORD_LENGTH - 1 ||
+        compiled.header->num_words > MAX_WORDS - 1) {
+        fprintf(stderr, "%s: more than %d words, or a word longer than %d\n",
+                filename, MAX_WORDS - 1, MAX_WORD_LENGTH - 1);
+        exit(1);
+    }
+    words = malloc((compiled.header->num_words + 1) * sizeof(*words));
+    if (words == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < compiled.header->num_words; i++) {
+        words[i] = (char *)dict_word(&compiled, i);
+    }
+    words[compiled.header->num_words] = NULL;
+    return words;
+}
+
+/* Read all words from filename and return them in a 2D array. filename
+   may be a plain word list or a dictionary compiled with dictc. */
 char **read_words(char *filename) {
     char buffer[MAX_WORD_LENGTH + 1];
     FILE *fp;
     int word_count;
     char **words;
 
+    if (dict_is_compiled(filename)) {
+        return map_words(filename);
+    }
+
     fp = fopen(filename, "r");
     if (!fp) {
       perror("fopen");
@@ -25,6 +65,10 @@ char **read_words(char *filename) {
 
     /*Get and store all words*/
     while (fgets(buffer, MAX_WORD_LENGTH, fp)) {
+        if (word_count == MAX_WORDS - 1) {
+            fprintf(stderr, "%s: more than %d words\n", filename, MAX_WORDS - 1);
+            exit(1);
+        }
         if(buffer[strlen(buffer) - 1] == '\n') {
             buffer[strlen(buffer) - 1] = '\0'; /*Delete newline*/
         }
@@ -47,6 +91,11 @@ char **read_words(char *filename) {
 /* Deallocate all memory acquired by read_words. */
 void deallocate_words(char **words) {
     char **p = words;
+    if (compiled.header != NULL) {
+        free(words);
+        dict_close(&compiled);
+        return;
+    }
     while(*p) {
         free(*p);
         p++;
@@ -223,12 +223,18 @@ void play_round(char **words) {
 
 
 /* Read words, initialize families, and play as long as
-   the user answers 'y'. */
-int main(void) {
+   the user answers 'y'. The dictionary defaults to DICTIONARY but
+   may be given on the command line, as a word list or compiled
+   with dictc. */
+int main(int argc, char **argv) {
     char again;
     char **words;
     
-    words = read_words("dictionary.txt");
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [dictionary]\n", argv[0]);
+        exit(1);
+    }
+    words = read_words(argc == 2 ? argv[1] : DICTIONARY);
     init_family(1024);    
 
     do {
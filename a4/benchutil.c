@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+
+#include "benchutil.h"
+#include "gameplay.h"
+
+// Size of the buffer the welcome message is read into
+#define WELCOME_BUF 1024
+
+/*
+ * Return the time on the monotonic clock, in microseconds.
+ */
+double now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Return the CPU time this process has used, in microseconds.
+ */
+double self_cpu_usec(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*
+ * Return the CPU time process pid has used, in microseconds, or -1 if
+ * it cannot be read.
+ */
+double proc_cpu_usec(int pid) {
+    char path[64];
+    char stat[1024];
+    sprintf(path, "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    int n = fread(stat, 1, sizeof(stat) - 1, f);
+    fclose(f);
+    stat[n] = '\0';
+
+    // utime and stime are the 14th and 15th fields; the command name,
+    // which may hold spaces, ends at the last ')'
+    char *p = strrchr(stat, ')');
+    unsigned long utime, stime;
+    if (p == NULL ||
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &utime, &stime) != 2) {
+        return -1;
+    }
+    return (utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+/*
+ * Order doubles for qsort, smallest first.
+ */
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Connect to addr and wait for the welcome message, so that we know the
+ * server has accepted the connection before we open the next one.
+ */
+int connect_client(struct sockaddr *addr, socklen_t len) {
+    char buf[WELCOME_BUF];
+    int soc = socket(addr->sa_family, SOCK_STREAM, 0);
+    if (soc < 0) {
+        perror("socket");
+        exit(1);
+    }
+    if (connect(soc, addr, len) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    if (addr->sa_family == AF_INET) {
+        // The replies are small, so do not let them wait on each other
+        int on = 1;
+        setsockopt(soc, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    int total = 0;
+    int welcome_len = strlen(WELCOME_MSG);
+    while (total < welcome_len) {
+        int n = read(soc, buf, sizeof(buf));
+        if (n <= 0) {
+            fprintf(stderr, "server closed connection during welcome\n");
+            exit(1);
+        }
+        total += n;
+    }
+    return soc;
+}
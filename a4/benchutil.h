@@ -0,0 +1,16 @@
+#ifndef _BENCHUTIL_H_
+#define _BENCHUTIL_H_
+
+#include <sys/socket.h>
+
+/* Helpers shared by the benchmark and load tools: timing, CPU use, and
+ * connecting a client that has been greeted by the server.
+ */
+
+double now_usec(void);
+double self_cpu_usec(void);
+double proc_cpu_usec(int pid);
+int compare_doubles(const void *a, const void *b);
+int connect_client(struct sockaddr *addr, socklen_t len);
+
+#endif
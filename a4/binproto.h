@@ -0,0 +1,94 @@
+#ifndef _BINPROTO_H_
+#define _BINPROTO_H_
+
+#include <stdint.h>
+
+/* The binary protocol, for bots and gateways, served on the same port as
+ * the text one. A client reads the text welcome message as usual, then
+ * sends a BIN_HELLO frame instead of a name; from then on both sides
+ * send only frames. Every frame starts with a struct bin_hdr whose len
+ * counts the whole frame, header included, and a text client can never
+ * be mistaken for a binary one, since a frame starts with a zero byte.
+ *
+ * Multi-byte integers are in network byte order. Names, words and text
+ * fill the rest of their frame and are not null terminated.
+ *
+ * A client joins with BIN_JOIN and guesses with BIN_GUESS. Anything else
+ * a text client could type, such as a resume request, is sent as a line
+ * in BIN_TEXT. The server sends the game as BIN_STATUS, BIN_GUESSED,
+ * BIN_TURN and BIN_OVER frames, and everything else, such as players
+ * joining and leaving or errors, as the text message it would send a
+ * text client, in BIN_TEXT.
+ */
+
+#define BIN_VERSION 1
+// The longest frame either side may send
+#define BIN_MAX_FRAME 255
+
+enum bin_type {
+    BIN_HELLO = 1,      // Either way: struct bin_hello
+    BIN_TEXT,           // Either way: a line from the client, without
+                        // its \r\n, or a message from the server
+    BIN_JOIN,           // Client: the name to play under
+    BIN_GUESS,          // Client: struct bin_guess
+    BIN_STATUS,         // Server: struct bin_status, the whole game
+    BIN_GUESSED,        // Server: struct bin_guessed, a change to it
+    BIN_TURN,           // Server: struct bin_turn
+    BIN_OVER            // Server: struct bin_over
+};
+
+// How a game ended, in struct bin_over
+enum bin_result {
+    BIN_LOST,           // Nobody found the word
+    BIN_WON,            // The receiving player found it
+    BIN_OTHER_WON       // Another player, named in the frame, found it
+};
+
+struct bin_hdr {
+    uint16_t len;
+    uint8_t type;
+} __attribute__((packed));
+
+struct bin_hello {
+    struct bin_hdr hdr;
+    uint8_t version;
+} __attribute__((packed));
+
+struct bin_guess {
+    struct bin_hdr hdr;
+    char letter;
+} __attribute__((packed));
+
+// Sent when a player joins or resumes and when a new game starts
+struct bin_status {
+    struct bin_hdr hdr;
+    uint8_t guesses_left;
+    uint32_t guessed;       // Bit i is set once letter 'a' + i is guessed
+    char word[];            // The word so far, '-' for hidden letters
+} __attribute__((packed));
+
+// Sent after each guess that does not end the game. The guesser is the
+// player whose turn it was.
+struct bin_guessed {
+    struct bin_hdr hdr;
+    char letter;
+    uint8_t guesses_left;
+    uint32_t positions;     // Bit j is set if the letter is at position j
+                            // of the word; 0 if it is not in the word
+} __attribute__((packed));
+
+struct bin_turn {
+    struct bin_hdr hdr;
+    uint8_t yours;          // 1 if the receiving player is to guess
+    char name[];
+} __attribute__((packed));
+
+struct bin_over {
+    struct bin_hdr hdr;
+    uint8_t result;         // An enum bin_result
+    uint8_t word_len;
+    char text[];            // The word, then the winner's name if another
+                            // player won
+} __attribute__((packed));
+
+#endif
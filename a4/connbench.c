@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "gameplay.h"
+#include "benchutil.h"
+
+#ifndef PORT
+    #define PORT 56480
+#endif
+
+/*
+ * Connection-count scaling benchmark for wordsrv.
+ *
+ * For each connection count N, opens N idle clients that sit at the name
+ * prompt, then times a single probe client that repeatedly sends an empty
+ * name and waits for the server to reject it. Every round trip is exactly
+ * one event for the server, so the time per round trip should stay flat as
+ * N grows if the server only looks at ready descriptors.
+ *
+ * Given the server's process id with -P, also reports how much the
+ * server's resident memory grew per idle client while they were
+ * connected. Memory the server freed earlier is reused first, so the
+ * figure is only exact for the first count run against a fresh server.
+ *
+ * Usage: connbench [-h host] [-p port] [-r rounds] [-P server_pid] [N ...]
+ */
+
+#define DEFAULT_ROUNDS 2000
+#define REJECT_MSG "Your name?\r\n"
+
+/*
+ * Send an empty name and read until the prompt that follows the rejection.
+ */
+void round_trip(int soc) {
+    char buf[MAX_BUF];
+    int reject_len = strlen(REJECT_MSG);
+    int total = 0;
+
+    if (write(soc, "\r\n", 2) != 2) {
+        perror("write");
+        exit(1);
+    }
+    // The reply always ends with the prompt, so it is complete once the
+    // last bytes we have seen match it.
+    while (1) {
+        int n = read(soc, buf + total, sizeof(buf) - total - 1);
+        if (n <= 0) {
+            fprintf(stderr, "server closed probe connection\n");
+            exit(1);
+        }
+        total += n;
+        if (total >= reject_len &&
+            memcmp(buf + total - reject_len, REJECT_MSG, reject_len) == 0) {
+            return;
+        }
+        if (total >= sizeof(buf) - 1) {
+            total = 0;
+        }
+    }
+}
+
+/*
+ * Return the resident memory of process pid in kilobytes, or -1 if it
+ * cannot be read.
+ */
+long rss_kb(int pid) {
+    char path[64];
+    char line[256];
+    long kb = -1;
+    sprintf(path, "/proc/%d/status", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmRSS: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+int main(int argc, char **argv) {
+    static const int default_counts[] = {10, 100, 1000, 10000};
+    char *host = "127.0.0.1";
+    int port = PORT;
+    int rounds = DEFAULT_ROUNDS;
+    int server_pid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:r:P:")) != -1) {
+        switch (opt) {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            rounds = strtol(optarg, NULL, 10);
+            break;
+        case 'P':
+            server_pid = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-r rounds] "
+                    "[-P server_pid] [N ...]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", host);
+        exit(1);
+    }
+
+    int num_counts = argc - optind;
+    printf("%10s %12s %14s %14s\n", "clients", "rounds", "usec/event", "rss/client");
+    for (int c = 0; c < (num_counts ? num_counts : 4); c++) {
+        int n = num_counts ? strtol(argv[optind + c], NULL, 10) : default_counts[c];
+        int *idle = malloc(n * sizeof(int));
+        if (idle == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        long rss_before = server_pid ? rss_kb(server_pid) : -1;
+        for (int i = 0; i < n; i++) {
+            idle[i] = connect_client((struct sockaddr *)&addr, sizeof(addr));
+        }
+
+        int probe = connect_client((struct sockaddr *)&addr, sizeof(addr));
+        // Warm up before timing
+        for (int i = 0; i < rounds / 10; i++) {
+            round_trip(probe);
+        }
+        double start = now_usec();
+        for (int i = 0; i < rounds; i++) {
+            round_trip(probe);
+        }
+        double elapsed = now_usec() - start;
+        long rss_after = server_pid ? rss_kb(server_pid) : -1;
+        printf("%10d %12d %14.2f ", n, rounds, elapsed / rounds);
+        if (rss_before >= 0 && rss_after >= 0) {
+            printf("%14.0f\n", (rss_after - rss_before) * 1024.0 / n);
+        } else {
+            printf("%14s\n", "-");
+        }
+
+        close(probe);
+        for (int i = 0; i < n; i++) {
+            close(idle[i]);
+        }
+        free(idle);
+        // Give the server a moment to process the disconnects
+        usleep(200000);
+    }
+    return 0;
+}
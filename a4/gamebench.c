@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "gameplay.h"
+
+/*
+ * Microbenchmark for the game logic in gameplay.c.
+ *
+ * Plays the given number of games against words from the dictionary,
+ * guessing letters in a random order until each game is won or lost, and
+ * reports the time per call of each gameplay function:
+ *   - init_game, which picks and indexes a new word
+ *   - a guess: check_guess, apply_guess and check_game_over together
+ *   - status_message after a guess, which renders a fresh status
+ *   - status_message again with nothing changed, which reuses it
+ *
+ * The cost of reading the clock around each call is measured first and
+ * taken off every figure.
+ *
+ * Usage: gamebench [-n games] <dictionary filename>
+ */
+
+#define DEFAULT_GAMES 1000000
+
+/*
+ * Return the current time in nanoseconds.
+ */
+double now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Return the time it takes to read the clock, in nanoseconds.
+ */
+double clock_overhead(void) {
+    int rounds = 1000000;
+    double start = now_nsec();
+    for (int i = 0; i < rounds; i++) {
+        now_nsec();
+    }
+    return (now_nsec() - start) / rounds;
+}
+
+/*
+ * Return time less overhead, but never less than zero.
+ */
+double net(double time, double overhead) {
+    return time > overhead ? time - overhead : 0;
+}
+
+/*
+ * Shuffle the alphabet into order, so each game guesses letters in a
+ * different sequence.
+ */
+void shuffle(char *order) {
+    for (int i = NUM_LETTERS - 1; i > 0; i--) {
+        int j = random() % (i + 1);
+        char t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+int main(int argc, char **argv) {
+    int games = DEFAULT_GAMES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            games = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n games] <dictionary filename>\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 1 || games <= 0) {
+        fprintf(stderr, "Usage: %s [-n games] <dictionary filename>\n", argv[0]);
+        exit(1);
+    }
+
+    struct dictionary dict;
+    load_dictionary(&dict, argv[optind]);
+    srandom(1);
+
+    struct game_state game;
+    memset(&game, 0, sizeof(game));
+    game.rng = 1;
+
+    char order[NUM_LETTERS];
+    for (int i = 0; i < NUM_LETTERS; i++) {
+        order[i] = 'a' + i;
+    }
+
+    double init_time = 0, guess_time = 0, render_time = 0, reuse_time = 0;
+    long guesses = 0, wins = 0;
+    long status_bytes = 0;
+
+    for (int g = 0; g < games; g++) {
+        shuffle(order);
+
+        double start = now_nsec();
+        init_game(&game, &dict);
+        init_time += now_nsec() - start;
+
+        int over = 0;
+        for (int i = 0; i < NUM_LETTERS && !over; i++) {
+            char guess[2] = {order[i], '\0'};
+
+            start = now_nsec();
+            if (check_guess(guess, &game) == 0) {
+                apply_guess(&game, guess[0]);
+            }
+            over = check_game_over(&game);
+            double mid = now_nsec();
+            struct msg *status = status_message(&game);
+            double rendered = now_nsec();
+            status_message(&game);
+            double reused = now_nsec();
+
+            guess_time += mid - start;
+            render_time += rendered - mid;
+            reuse_time += reused - rendered;
+            status_bytes += status->len;
+            guesses++;
+        }
+        wins += (over == 1);
+    }
+
+    printf("%d games, %ld guesses, %ld won, %.1f status bytes per guess\n",
+           games, guesses, wins, (double)status_bytes / guesses);
+    double overhead = clock_overhead();
+    printf("%-24s %12s\n", "function", "nsec/call");
+    printf("%-24s %12.1f\n", "init_game", net(init_time / games, overhead));
+    printf("%-24s %12.1f\n", "guess", net(guess_time / guesses, overhead));
+    printf("%-24s %12.1f\n", "status_message (render)", net(render_time / guesses, overhead));
+    printf("%-24s %12.1f\n", "status_message (reuse)", net(reuse_time / guesses, overhead));
+    return 0;
+}
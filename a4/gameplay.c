@@ -2,95 +2,370 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
 
 #include "gameplay.h"
+#include "binproto.h"
+#include "dictfile.h"
+#include "log.h"
 
-/* Return a status message that shows the current state of the game.
- * Assumes that the caller has allocated MAX_MSG bytes for msg.
- */
-char *status_message(char *msg, struct game_state *game) {
-    sprintf(msg, "***************\r\n"
-           "Word to guess: %s\r\nGuesses remaining: %d\r\n"
-           "Letters guessed: \r\n", game->guess, game->guesses_left);
-    for(int i = 0; i < 26; i++){
-        if(game->letters_guessed[i]) {
-            int len = strlen(msg);
-            msg[len] = (char)('a' + i);
-            msg[len + 1] = ' ';
-            msg[len + 2] = '\0';
-        }
+/*
+ * Append the len bytes at src to the text at *dst and advance *dst.
+ */
+static void append(char **dst, const char *src, int len) {
+    memcpy(*dst, src, len);
+    *dst += len;
+}
+
+// Append a string literal, whose length is known at compile time
+#define append_literal(dst, s) append(dst, s, sizeof(s) - 1)
+
+/* Return a message that shows the current state of the game. It is
+ * rendered only when the game has changed since it was last asked for;
+ * otherwise the same message is returned again. The game keeps its own
+ * reference, so the caller must not unref it.
+ */
+struct msg *status_message(struct game_state *game) {
+    if (game->status != NULL && game->status_version == game->version) {
+        return game->status;
+    }
+
+    char buf[MAX_STATUS];
+    char *p = buf;
+    append_literal(&p, "***************\r\nWord to guess: ");
+    append(&p, game->guess, game->len);
+    append_literal(&p, "\r\nGuesses remaining: ");
+    p += sprintf(p, "%d", game->guesses_left);
+    append_literal(&p, "\r\nLetters guessed: \r\n");
+    for (unsigned int left = game->guessed; left != 0; left &= left - 1) {
+        *p++ = 'a' + __builtin_ctz(left);
+        *p++ = ' ';
+    }
+    append_literal(&p, "\r\n***************\r\n");
+
+    if (game->status != NULL) {
+        msg_unref(game->status);
+    }
+    game->status = msg_new(buf, p - buf);
+    game->status_version = game->version;
+    return game->status;
+}
+
+/* Return a new one-line message with the state of the game for a
+ * spectator: the word so far, the guesses left and the letters guessed.
+ * The caller owns the reference.
+ */
+struct msg *watch_message(struct game_state *game) {
+    char buf[MAX_STATUS];
+    char *p = buf;
+    append_literal(&p, "Watching: ");
+    append(&p, game->guess, game->len);
+    p += sprintf(p, " (%d left) ", game->guesses_left);
+    for (unsigned int left = game->guessed; left != 0; left &= left - 1) {
+        *p++ = 'a' + __builtin_ctz(left);
     }
-    strncat(msg, "\r\n***************\r\n", MAX_MSG);
-    return msg;
+    append_literal(&p, "\r\n");
+    return msg_new(buf, p - buf);
 }
 
+/*
+ * Fill in the header of the len byte frame of the given type at buf and
+ * return a new message holding it. The caller owns the reference.
+ */
+static struct msg *frame_message(char *buf, int type, int len) {
+    struct bin_hdr *hdr = (struct bin_hdr *)buf;
+    hdr->len = htons(len);
+    hdr->type = type;
+    return msg_new(buf, len);
+}
+
+/* Return a new binary frame of the given type carrying the len bytes at
+ * body, cut short if they do not fit in a frame. The caller owns the
+ * reference.
+ */
+struct msg *bin_frame(int type, const char *body, int len) {
+    char buf[BIN_MAX_FRAME];
+    if (len > BIN_MAX_FRAME - (int)sizeof(struct bin_hdr)) {
+        len = BIN_MAX_FRAME - sizeof(struct bin_hdr);
+    }
+    memcpy(buf + sizeof(struct bin_hdr), body, len);
+    return frame_message(buf, type, sizeof(struct bin_hdr) + len);
+}
+
+/* The binary counterpart of status_message, cached the same way: the
+ * game keeps its own reference, so the caller must not unref it.
+ */
+struct msg *bin_status_message(struct game_state *game) {
+    if (game->bin_status != NULL && game->bin_status_version == game->version) {
+        return game->bin_status;
+    }
+
+    char buf[BIN_MAX_FRAME];
+    struct bin_status *f = (struct bin_status *)buf;
+    f->guesses_left = game->guesses_left;
+    f->guessed = htonl(game->guessed);
+    memcpy(f->word, game->guess, game->len);
+
+    if (game->bin_status != NULL) {
+        msg_unref(game->bin_status);
+    }
+    game->bin_status = frame_message(buf, BIN_STATUS, sizeof(*f) + game->len);
+    game->bin_status_version = game->version;
+    return game->bin_status;
+}
+
+/* Return a new frame telling binary clients that letter has just been
+ * guessed in game, and where it is in the word. The caller owns the
+ * reference.
+ */
+struct msg *bin_guessed_message(struct game_state *game, char letter) {
+    struct bin_guessed f;
+    f.letter = letter;
+    f.guesses_left = game->guesses_left;
+    f.positions = htonl(game->positions[letter - 'a']);
+    return frame_message((char *)&f, BIN_GUESSED, sizeof(f));
+}
+
+/* Return a new frame saying that it is the turn of the player called
+ * name, who is the recipient if yours is 1. The caller owns the
+ * reference.
+ */
+struct msg *bin_turn_message(const char *name, int yours) {
+    char buf[BIN_MAX_FRAME];
+    struct bin_turn *f = (struct bin_turn *)buf;
+    int len = strlen(name);
+    f->yours = yours;
+    memcpy(f->name, name, len);
+    return frame_message(buf, BIN_TURN, sizeof(*f) + len);
+}
+
+/* Return a new frame saying that game is over with result, an enum
+ * bin_result; winner names the player who won if it was someone other
+ * than the recipient, and is NULL otherwise. The caller owns the
+ * reference.
+ */
+struct msg *bin_over_message(struct game_state *game, int result, const char *winner) {
+    char buf[BIN_MAX_FRAME];
+    struct bin_over *f = (struct bin_over *)buf;
+    int len = (winner != NULL) ? strlen(winner) : 0;
+    f->result = result;
+    f->word_len = game->len;
+    memcpy(f->text, game->word, game->len);
+    if (winner != NULL) {
+        memcpy(f->text + game->len, winner, len);
+    }
+    return frame_message(buf, BIN_OVER, sizeof(*f) + game->len + len);
+}
+
+/*
+ * Start game on the first len letters of word, with nothing guessed.
+ */
+static void start_word(struct game_state *game, const char *word, int len) {
+    if (len > MAX_WORD - 1) {
+        len = MAX_WORD - 1;
+    }
+    memcpy(game->word, word, len);
+    game->word[len] = '\0';
+    memset(game->guess, '-', len);
+    game->guess[len] = '\0';
+    game->len = len;
+
+    memset(game->positions, 0, sizeof(game->positions));
+    for (int i = 0; i < len; i++) {
+        // Anything but a lowercase letter can never be guessed, so it is
+        // shown from the start
+        if (word[i] >= 'a' && word[i] <= 'z') {
+            game->positions[word[i] - 'a'] |= 1u << i;
+        } else {
+            game->guess[i] = word[i];
+        }
+    }
+    game->remaining = 0;
+    for (int i = 0; i < NUM_LETTERS; i++) {
+        game->remaining += __builtin_popcount(game->positions[i]);
+    }
+    game->guessed = 0;
+    game->guesses_left = MAX_GUESSES;
+    game->version++;
+}
 
 /* Initialize the gameboard: 
- *    - initialize dictionary
- *    - select a random word to guess from the dictionary file
+ *    - select a random word to guess from the dictionary
  *    - set guess to all dashes ('-')
  *    - initialize the other fields
+ * The word comes from dict, which the game does not keep, so that the
+ * dictionary can be replaced once the word is chosen.
  * We can't initialize head and has_next_turn because these will have
  * different values when we use init_game to create a new game after one
  * has already been played
  */
-void init_game(struct game_state *game, char *dict_name) {
-    char buf[MAX_WORD];
-    if(game->dict.fp != NULL) {
-        rewind(game->dict.fp);
-    } else {
-        game->dict.fp = fopen(dict_name, "r");
-        if(game->dict.fp == NULL) {
-            perror("Opening dictionary");
-            exit(1);
-        }
-    } 
-
-    int index = random() % game->dict.size;
-    printf("Looking for word at index %d\n", index);
-    for(int i = 0; i <= index; i++) {
-        if(!fgets(buf, MAX_WORD, game->dict.fp)){
-            fprintf(stderr,"File ended before we found the entry index %d",index);
-            exit(1);
-        }
-    } 
+void init_game(struct game_state *game, struct dictionary *dict) {
+    int index = rand_r(&game->rng) % dict->size;
+    log_msg(LOG_DEBUG, "Looking for word at index %d\n", index);
 
-    // Found word
-    if(buf[strlen(buf) - 1] == '\n') {  // from a unix file
-        buf[strlen(buf) - 1] = '\0';
-    } else {
-        fprintf(stderr, "The dictionary file does not appear to have Unix line endings\n");
+    // The word runs up to the newline that ends its line, with any
+    // carriage return from a DOS file dropped as well
+    const char *word = dict->text + dict->offsets[index];
+    int len = dict->offsets[index + 1] - dict->offsets[index] - 1;
+    if (len > 0 && word[len - 1] == '\r') {
+        len--;
     }
-    strncpy(game->word, buf, MAX_WORD);
-    game->word[MAX_WORD-1] = '\0';
-    for(int j = 0; j < strlen(game->word); j++) {
-        game->guess[j] = '-';
+    start_word(game, word, len);
+}
+
+/*
+ * Put game back in a state saved elsewhere: word, with the letters in
+ * the guessed mask revealed and guesses_left guesses to go.
+ */
+void resume_game(struct game_state *game, const char *word, unsigned int guessed,
+                 int guesses_left) {
+    start_word(game, word, strnlen(word, MAX_WORD - 1));
+    for (unsigned int left = guessed & ((1u << NUM_LETTERS) - 1); left != 0;
+         left &= left - 1) {
+        apply_guess(game, 'a' + __builtin_ctz(left));
     }
-    game->guess[strlen(game->word)] = '\0';
+    game->guesses_left = guesses_left;
+}
 
-    for(int i = 0; i < NUM_LETTERS; i++) {
-        game->letters_guessed[i] = 0;
+/* Return 1 if guess is not a single lowercase letter, 2 if that letter
+ * has already been guessed, and 0 if it is a valid guess.
+ */
+int check_guess(char *guess, struct game_state *game) {
+    if (guess[0] < 'a' || guess[0] > 'z' || guess[1] != '\0') {
+        return 1;
+    } else if (game->guessed & (1u << (guess[0] - 'a'))) {
+        return 2;
     }
-    game->guesses_left = MAX_GUESSES;
+    return 0;
+}
+
+/* Reveal every occurrence of the letter guess in the word, or use up a
+ * guess if there are none. Return 1 if the letter is in the word and 0
+ * otherwise.
+ */
+int apply_guess(struct game_state *game, char guess) {
+    int letter = guess - 'a';
+    unsigned int found = game->positions[letter];
+
+    game->guessed |= 1u << letter;
+    game->version++;
+    if (found == 0) {
+        game->guesses_left--;
+        return 0;
+    }
+    for (unsigned int left = found; left != 0; left &= left - 1) {
+        game->guess[__builtin_ctz(left)] = guess;
+    }
+    game->remaining -= __builtin_popcount(found);
+    return 1;
+}
 
+/* Return 2 if the players have run out of guesses, 1 if the whole word
+ * has been revealed, and 0 if the game goes on.
+ */
+int check_game_over(struct game_state *game) {
+    if (game->guesses_left == 0) {
+        return 2;
+    }
+    return game->remaining == 0;
 }
 
 
-/* Return the number of lines in the file
+/* Map the dictionary file into memory and record where each of its words
+ * starts. Returns 0 on success, or -1 if the file cannot be loaded or
+ * holds no words.
  */
-int get_file_length(char *filename) {
-    char buf[MAX_MSG];
-    int count = 0;
-    FILE *fp;
-    if((fp = fopen(filename, "r")) == NULL) {
-        perror("open");
-        exit(1);
+int open_dictionary(struct dictionary *dict, const char *filename) {
+    // A compiled dictionary needs no indexing at all
+    if (dict_is_compiled(filename)) {
+        struct dict_file d;
+        if (dict_open(&d, filename) < 0) {
+            return -1;
+        }
+        dict->text = d.pool;
+        dict->offsets = d.offsets;
+        dict->size = d.header->num_words;
+        dict->map = (void *)d.header;
+        dict->map_size = d.map_size;
+        dict->index = NULL;
+        return 0;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Opening dictionary");
+        return -1;
     }
-    
-    while(fgets(buf, MAX_MSG, fp) != NULL) {
-        count++;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
     }
-    
-    fclose(fp);
-    return count;
+    if (st.st_size == 0) {
+        fprintf(stderr, "The dictionary %s is empty\n", filename);
+        close(fd);
+        return -1;
+    }
+    char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    // Count the lines first so the index is allocated exactly once. A
+    // last line without a newline still counts as a word.
+    int size = 0;
+    for (char *c = text; c < text + st.st_size; c++) {
+        if (*c == '\n') {
+            size++;
+        }
+    }
+    int unterminated = (text[st.st_size - 1] != '\n');
+    size += unterminated;
+
+    unsigned int *offsets = malloc((size + 1) * sizeof(unsigned int));
+    if (offsets == NULL) {
+        perror("malloc");
+        munmap(text, st.st_size);
+        return -1;
+    }
+    int n = 0;
+    offsets[n++] = 0;
+    for (off_t i = 0; i < st.st_size; i++) {
+        if (text[i] == '\n' && n <= size) {
+            offsets[n++] = i + 1;
+        }
+    }
+    // Pretend an unterminated last line ends one past the end of the file
+    if (unterminated) {
+        offsets[size] = st.st_size + 1;
+    }
+    dict->text = text;
+    dict->offsets = offsets;
+    dict->size = size;
+    dict->map = text;
+    dict->map_size = st.st_size;
+    dict->index = offsets;
+    return 0;
+}
+
+/* Load the dictionary as open_dictionary does, but terminate with exit
+ * code 1 if it cannot be loaded.
+ */
+void load_dictionary(struct dictionary *dict, const char *filename) {
+    if (open_dictionary(dict, filename) < 0) {
+        exit(1);
+    }
+}
+
+/* Release the mapping and index of dict, which no game may be using.
+ */
+void close_dictionary(struct dictionary *dict) {
+    munmap(dict->map, dict->map_size);
+    free(dict->index);
 }
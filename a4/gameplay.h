@@ -1,4 +1,13 @@
 #include <netinet/in.h>
+#include <pthread.h>
+
+#include "outq.h"
+#include "linebuf.h"
+#include "timer.h"
+#include "nameset.h"
+#include "metrics.h"
+#include "uring.h"
+#include "pool.h"
 
 #define MAX_NAME 30  
 #define MAX_MSG 128
@@ -7,35 +16,165 @@
 #define MAX_GUESSES 4
 #define NUM_LETTERS 26
 #define WELCOME_MSG "Welcome to our word game. What is your name? "
+// Room for the longest status message: a full word and every letter
+#define MAX_STATUS 192
 
 struct client {
     int fd;
     struct in_addr ipaddr;
     struct client *next;
+    struct client *reap_next; // Link in the list of clients waiting to be freed
     char name[MAX_NAME];
-    char inbuf[MAX_BUF];  // Used to hold input from the client
-    char *in_ptr;         // A pointer into inbuf to help with partial reads
+    struct line_buf in;   // Input from the client, split into lines
+    struct out_queue outq;  // Output not yet accepted by the socket
+    int want_write;       // 1 if the event loop is watching for EPOLLOUT,
+                          // or while a send is in flight with io_uring
+    int closing;          // 1 once the client is marked for disconnection
+    struct room *room;    // The room the client was placed in when it
+                          // connected, or the one it is watching
+    struct timer idle;    // Fires if the client sends nothing for too long,
+                          // or when a held seat is given up
+    unsigned long long token; // Resume token, or 0 if none was issued
+    int held;             // 1 while the connection is gone but the seat is
+                          // kept for a resume; fd is then -1
+    struct client *held_next; // Link in the shard's list of held players
+    int spectator;        // 1 if the client watches the game instead of playing
+    unsigned int seen_version; // Game version of the last update sent to
+                               // a spectator
+    int corked;           // 1 while on the shard's list of clients with
+                          // output to write at the end of the iteration
+    struct client *corked_next;
+    struct conn_op *recv; // With io_uring, the request reading from fd
+    struct send_op *send; // With io_uring, the send in flight, if any
+    int binary;           // 1 if the client speaks the binary protocol
 };
 
-// Information about the dictionary used to pick random word
+/* The dictionary used to pick random words. The file is mapped into
+ * memory once and indexed by the offset of each word, so choosing a word
+ * is a single random index. It is never modified after loading and is
+ * shared by every room. A game copies its word out when it starts, so a
+ * dictionary can be replaced without disturbing games in progress.
+ *
+ * A plain word list is indexed by line when it is loaded; a dictionary
+ * compiled with dictc already holds the index and is used in place.
+ * Either way each word is followed by one terminator byte (a newline or
+ * a null), so word i is offsets[i + 1] - offsets[i] - 1 bytes long.
+ */
 struct dictionary {
-    FILE *fp;
-    int size;
+    const char *text;             // The mapped words
+    const unsigned int *offsets;  // offsets[i] is where word i starts in
+                                  // text; offsets[size] is the end
+    int size;                     // Number of words
+    void *map;                    // The mapping, released by
+    size_t map_size;              // close_dictionary
+    unsigned int *index;          // offsets if built when loading, or NULL
 };
 
+/* The state of one game. Letters are tracked as bitmasks, so a guess
+ * touches only the positions it reveals and the end of the game is a
+ * counter check rather than a scan of the word.
+ */
 struct game_state {
     char word[MAX_WORD];      // The word to guess
     char guess[MAX_WORD];     // The current guess (for example '-o-d')
-    int letters_guessed[NUM_LETTERS]; // Index i will be 1 if the corresponding
-                                      // letter has been guessed; 0 otherwise
+    int len;                  // Letters in word
+    unsigned int guessed;     // Bit i is set once letter 'a' + i is guessed
+    unsigned int positions[NUM_LETTERS]; // Bit j of positions[i] is set if
+                                         // word[j] is letter 'a' + i
+    int remaining;            // Letters of word not yet revealed
     int guesses_left;         // Number of guesses remaining
-    struct dictionary dict;
+    unsigned int version;     // Changes whenever the status would change
+    struct msg *status;       // Status message rendered at status_version,
+    unsigned int status_version; // or NULL if none has been yet
+    struct msg *bin_status;   // The same for binary clients
+    unsigned int bin_status_version;
+    unsigned int rng;         // Word generator state, so that the words of
+                              // a game depend only on how it was seeded
     
     struct client *head;
     struct client *has_next_turn;
+    struct name_set names;    // Names of the players in head
+};
+
+// One independent game and the clients placed in it
+struct room {
+    struct game_state game;
+    struct client *new_players; // Clients that have not yet entered a name
+    int num_clients;            // Players plus new_players
+    int num_players;            // Players in the game, counting held seats
+    struct timer turn_timer;    // Fires if the player whose turn it is
+                                // takes too long to guess
+    struct client *turn_owner;  // The player turn_timer was armed for
+    struct client *spectators;  // Clients watching the game; not counted
+                                // in num_clients
+    struct timer watch_timer;   // Sends the next update to spectators
+    struct msg *watch_msg;      // Latest update for spectators, or NULL
+    unsigned int watch_version; // Game version watch_msg shows
+    unsigned long watch_sent;   // When watch_msg was rendered, in ms
+    struct client *watch_cursor; // Next spectator to send watch_msg to
+    int id;
+    struct shard *shard;        // The shard that owns this room
+    struct room *next;
+};
+
+/* A worker thread with its own event loop and its own set of rooms.
+ * Nothing in a shard is touched by any other thread, except load, which
+ * the acceptor reads to place new connections.
+ */
+struct shard {
+    int id;
+    pthread_t thread;
+    int epfd;
+    struct uring ring;          // Used instead of epfd with io_uring
+    struct uring_bufs bufs;     // Buffers the ring receives input into
+    struct uring_op notify_op;  // Watches notify with io_uring
+    int notify[2];              // Pipe the acceptor hands connections through
+    struct room *rooms;
+    int num_rooms;
+    struct client *closing;     // Clients marked for disconnection
+    struct client *graveyard;   // Clients removed in the current iteration
+    struct timer_wheel timers;  // Turn and idle timers of every client
+    struct client *held;        // Players whose seats are held for a resume
+    struct client *corked;      // Clients with output queued in this iteration
+    struct pool clients;        // Where the shard's clients are allocated
+    struct pool inbufs;         // Input buffers leased by its clients
+    int load;                   // Clients in the shard (atomic)
+    int frozen;                 // 1 once stopped to hand over to a new process
+    unsigned long iterations;   // Loop iterations finished (atomic)
+    int waiting;                // 1 while not in a loop iteration (atomic)
+    struct shard_stats stats;   // Read by the admin thread without locking
+    int guesses;                // Lines from players in this iteration
+};
+
+// A connection passed to a shard, by the acceptor or by another shard
+// when the connection resumes a seat held there or watches a game there.
+// An fd of -1 asks the shard to stop so its state can be handed to a new
+// process.
+struct handoff {
+    int fd;
+    struct in_addr addr;
+    unsigned long long token;   // Seat to resume, or 0 for a new client
+    int binary;                 // 1 if the connection speaks the binary protocol
+    int watch;                  // 1 to make the connection a spectator
+    int room;                   // Room to watch, or -1 to find watch_name
+    char watch_name[MAX_NAME];  // Player whose game to watch
+    int hops;                   // Shards already searched for watch_name
 };
 
 
-void init_game(struct game_state *game, char *dict_name);
-int get_file_length(char *filename);
-char *status_message(char *msg, struct game_state *game);
\ No newline at end of file
+int open_dictionary(struct dictionary *dict, const char *filename);
+void load_dictionary(struct dictionary *dict, const char *filename);
+void close_dictionary(struct dictionary *dict);
+void init_game(struct game_state *game, struct dictionary *dict);
+void resume_game(struct game_state *game, const char *word, unsigned int guessed,
+                 int guesses_left);
+int check_guess(char *guess, struct game_state *game);
+int apply_guess(struct game_state *game, char guess);
+int check_game_over(struct game_state *game);
+struct msg *status_message(struct game_state *game);
+struct msg *watch_message(struct game_state *game);
+struct msg *bin_frame(int type, const char *body, int len);
+struct msg *bin_status_message(struct game_state *game);
+struct msg *bin_guessed_message(struct game_state *game, char letter);
+struct msg *bin_turn_message(const char *name, int yours);
+struct msg *bin_over_message(struct game_state *game, int result, const char *winner);
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "gameplay.h"
+#include "benchutil.h"
+
+#ifndef PORT
+    #define PORT 56480
+#endif
+
+/*
+ * Reconnect benchmark for wordsrv: the cost of coming back with a resume
+ * token against joining again from scratch.
+ *
+ * A few observers join first and sit in the room. Then one player drops
+ * and reconnects over and over, first by entering a new name each time
+ * and then by resuming its seat with the token it was given. For each
+ * way it reports the time from connect until the player is back in the
+ * game, and the bytes the observers were sent as a result.
+ *
+ * Start wordsrv with one thread and a large room (for example -t 1
+ * -r 1000), so that everyone shares a room and held seats do not spill
+ * into new ones.
+ *
+ * Usage: joinbench [-h host] [-p port] [-r rounds] [-o observers]
+ */
+
+#define DEFAULT_ROUNDS 200
+#define DEFAULT_OBSERVERS 6
+// How long to let broadcasts to the observers arrive before counting
+#define SETTLE_USEC 200000
+
+// Size of the buffer a reply is collected in
+#define REPLY_BUF 4096
+
+/*
+ * Read from soc into buf until the text received so far contains until,
+ * or also until2 if it is not NULL. Returns the number of bytes read.
+ */
+int read_until(int soc, char *buf, const char *until, const char *until2) {
+    int total = 0;
+    buf[0] = '\0';
+    while (strstr(buf, until) == NULL &&
+           (until2 == NULL || strstr(buf, until2) == NULL)) {
+        if (total >= REPLY_BUF - 1) {
+            fprintf(stderr, "reply too long waiting for \"%s\"\n", until);
+            exit(1);
+        }
+        int n = read(soc, buf + total, REPLY_BUF - 1 - total);
+        if (n <= 0) {
+            fprintf(stderr, "server closed connection waiting for \"%s\"\n", until);
+            exit(1);
+        }
+        total += n;
+        buf[total] = '\0';
+
+        // The server sends a reply as several small writes, and the
+        // kernel holds back each one until the last is acknowledged, so
+        // acknowledge at once rather than timing the delayed ACK
+        int on = 1;
+        setsockopt(soc, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    }
+    return total;
+}
+
+/*
+ * Send line on soc and read until the turn has been announced, which is
+ * the last thing a player is sent on joining or resuming. Copies the
+ * reply into buf.
+ */
+void send_and_wait(int soc, const char *line, char *buf) {
+    if (write(soc, line, strlen(line)) != strlen(line)) {
+        perror("write");
+        exit(1);
+    }
+    // Either "Your guess?" or "It's <name>'s turn."
+    read_until(soc, buf, "Your guess?", "turn.");
+}
+
+/*
+ * Return the number of bytes waiting on every observer, reading them all.
+ */
+long drain(int *observers, int n) {
+    char buf[REPLY_BUF];
+    long total = 0;
+    usleep(SETTLE_USEC);
+    for (int i = 0; i < n; i++) {
+        int r;
+        while ((r = read(observers[i], buf, sizeof(buf))) > 0) {
+            total += r;
+        }
+    }
+    return total;
+}
+
+int main(int argc, char **argv) {
+    char *host = "127.0.0.1";
+    int port = PORT;
+    int rounds = DEFAULT_ROUNDS;
+    int num_observers = DEFAULT_OBSERVERS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:r:o:")) != -1) {
+        switch (opt) {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            rounds = strtol(optarg, NULL, 10);
+            break;
+        case 'o':
+            num_observers = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-r rounds] "
+                    "[-o observers]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", host);
+        exit(1);
+    }
+
+    // Names are made unique per run, so the benchmark can be run again
+    // while seats from the last run are still held
+    int run = getpid();
+    char buf[REPLY_BUF];
+    char line[MAX_MSG];
+
+    int *observers = malloc(num_observers * sizeof(int));
+    if (observers == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < num_observers; i++) {
+        observers[i] = connect_client((struct sockaddr *)&addr, sizeof(addr));
+        sprintf(line, "o%d_%d\r\n", run, i);
+        send_and_wait(observers[i], line, buf);
+        fcntl(observers[i], F_SETFL, O_NONBLOCK);
+    }
+    drain(observers, num_observers);
+
+    // Join from scratch each time, under a new name
+    double join_time = 0;
+    for (int i = 0; i < rounds; i++) {
+        double start = now_usec();
+        int soc = connect_client((struct sockaddr *)&addr, sizeof(addr));
+        sprintf(line, "j%d_%d\r\n", run, i);
+        send_and_wait(soc, line, buf);
+        join_time += now_usec() - start;
+        close(soc);
+    }
+    long join_bytes = drain(observers, num_observers);
+
+    // Join once for a token, then keep resuming that seat
+    int soc = connect_client((struct sockaddr *)&addr, sizeof(addr));
+    sprintf(line, "r%d\r\n", run);
+    send_and_wait(soc, line, buf);
+    char *token = strstr(buf, "token is ");
+    if (token == NULL) {
+        fprintf(stderr, "No resume token given; is the grace period (-G) 0?\n");
+        exit(1);
+    }
+    char token_text[17];
+    sscanf(token + strlen("token is "), "%16s", token_text);
+    close(soc);
+    drain(observers, num_observers);
+
+    double resume_time = 0;
+    for (int i = 0; i < rounds; i++) {
+        double start = now_usec();
+        soc = connect_client((struct sockaddr *)&addr, sizeof(addr));
+        sprintf(line, "/resume %s\r\n", token_text);
+        send_and_wait(soc, line, buf);
+        resume_time += now_usec() - start;
+        close(soc);
+    }
+    long resume_bytes = drain(observers, num_observers);
+
+    printf("%10s %12s %14s %22s\n", "reconnect", "rounds", "usec/reconnect",
+           "observer bytes/round");
+    printf("%10s %12d %14.1f %22.1f\n", "join", rounds, join_time / rounds,
+           (double)join_bytes / rounds);
+    printf("%10s %12d %14.1f %22.1f\n", "resume", rounds, resume_time / rounds,
+           (double)resume_bytes / rounds);
+    return 0;
+}
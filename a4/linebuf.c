@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "linebuf.h"
+#include "pool.h"
+
+#define MASK (LINEBUF_SIZE - 1)
+
+/*
+ * Initialize an empty line buffer, with no buffer leased.
+ */
+void linebuf_init(struct line_buf *lb) {
+    lb->data = NULL;
+    lb->start = 0;
+    lb->end = 0;
+    lb->scan = 0;
+    lb->cr = 0;
+    lb->discarding = 0;
+}
+
+/*
+ * Give lb a buffer from pool if it has none.
+ */
+static void lease(struct line_buf *lb, struct pool *pool) {
+    if (lb->data == NULL) {
+        lb->data = pool_get(pool);
+    }
+}
+
+/*
+ * Read as much from fd as fits in the free space of lb, which may wrap
+ * around the end of data, leasing a buffer from pool for it if needed.
+ * Returns the result of the readv call.
+ */
+int linebuf_read(struct line_buf *lb, int fd, struct pool *pool) {
+    struct iovec iov[2];
+    lease(lb, pool);
+    unsigned int free_space = LINEBUF_SIZE - (lb->end - lb->start);
+    unsigned int head = lb->end & MASK;
+    int n = 1;
+
+    iov[0].iov_base = lb->data + head;
+    if (head + free_space <= LINEBUF_SIZE) {
+        iov[0].iov_len = free_space;
+    } else {
+        iov[0].iov_len = LINEBUF_SIZE - head;
+        iov[1].iov_base = lb->data;
+        iov[1].iov_len = free_space - iov[0].iov_len;
+        n = 2;
+    }
+
+    int num_read = readv(fd, iov, n);
+    if (num_read > 0) {
+        lb->end += num_read;
+    } else {
+        linebuf_done(lb, pool);
+    }
+    return num_read;
+}
+
+/*
+ * Copy as many of the len bytes at data as fit in the free space of lb,
+ * for input that has already been received, leasing a buffer from pool
+ * for them if needed. Returns the number copied.
+ */
+int linebuf_put(struct line_buf *lb, const char *data, int len, struct pool *pool) {
+    lease(lb, pool);
+    unsigned int free_space = LINEBUF_SIZE - (lb->end - lb->start);
+    unsigned int n = (unsigned int)len < free_space ? (unsigned int)len : free_space;
+    unsigned int head = lb->end & MASK;
+    unsigned int first = LINEBUF_SIZE - head;
+
+    if (n <= first) {
+        memcpy(lb->data + head, data, n);
+    } else {
+        memcpy(lb->data + head, data, first);
+        memcpy(lb->data, data + first, n - first);
+    }
+    lb->end += n;
+    return n;
+}
+
+/*
+ * Give the buffer of lb back to pool if nothing is held in it, once the
+ * complete lines in it have been taken.
+ */
+void linebuf_done(struct line_buf *lb, struct pool *pool) {
+    if (lb->data != NULL && lb->start == lb->end) {
+        pool_put(pool, lb->data);
+        lb->data = NULL;
+    }
+}
+
+/*
+ * Drop whatever is held in lb, giving its buffer back to pool, and start
+ * again as a new stream.
+ */
+void linebuf_clear(struct line_buf *lb, struct pool *pool) {
+    if (lb->data != NULL) {
+        pool_put(pool, lb->data);
+    }
+    linebuf_init(lb);
+}
+
+/*
+ * Copy the bytes from start up to (not including) stop into line and
+ * null terminate it.
+ */
+static void copy_out(struct line_buf *lb, unsigned int stop, char *line) {
+    unsigned int len = stop - lb->start;
+    unsigned int first = LINEBUF_SIZE - (lb->start & MASK);
+    if (len <= first) {
+        memcpy(line, lb->data + (lb->start & MASK), len);
+    } else {
+        memcpy(line, lb->data + (lb->start & MASK), first);
+        memcpy(line + first, lb->data, len - first);
+    }
+    line[len] = '\0';
+}
+
+/*
+ * Look for the next complete line in lb, searching only bytes that have
+ * not been searched before. If one is found, copy it without its \r\n
+ * into line (which must hold LINEBUF_SIZE bytes) and return 1. Return 0
+ * if no complete line is buffered yet.
+ *
+ * If the buffer fills up without a newline, the line can never be
+ * completed: everything up to its eventual newline is dropped, and -1 is
+ * returned once so that the caller can tell the client.
+ */
+int linebuf_next(struct line_buf *lb, char *line) {
+    while (lb->scan != lb->end) {
+        char c = lb->data[lb->scan & MASK];
+        lb->scan++;
+        if (c == '\n' && lb->cr) {
+            lb->cr = 0;
+            if (lb->discarding) {
+                lb->discarding = 0;
+                lb->start = lb->scan;
+                continue;
+            }
+            copy_out(lb, lb->scan - 2, line);
+            lb->start = lb->scan;
+            return 1;
+        }
+        lb->cr = (c == '\r');
+    }
+
+    if (lb->discarding) {
+        // Nothing scanned so far belongs to a line we will keep
+        lb->start = lb->scan;
+    } else if (lb->end - lb->start == LINEBUF_SIZE) {
+        lb->discarding = 1;
+        lb->start = lb->scan;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Take the next complete frame from lb, for a client that sends frames
+ * instead of lines. A frame starts with its length, as two bytes in
+ * network order that count themselves and the rest of the frame. If one
+ * is buffered, copy it into frame (which must hold LINEBUF_SIZE bytes)
+ * followed by a null byte, and return its length. Return 0 if no frame
+ * is complete yet, and -1 if the length is shorter than three bytes (a
+ * length and a type) or would not fit in lb, since the rest of the input
+ * cannot then be split into frames.
+ */
+int linebuf_frame(struct line_buf *lb, char *frame) {
+    unsigned int held = lb->end - lb->start;
+    if (held < 2) {
+        return 0;
+    }
+    unsigned int len = (unsigned char)lb->data[lb->start & MASK] << 8 |
+                       (unsigned char)lb->data[(lb->start + 1) & MASK];
+    if (len < 3 || len >= LINEBUF_SIZE) {
+        return -1;
+    }
+    if (held < len) {
+        return 0;
+    }
+    copy_out(lb, lb->start + len, frame);
+    lb->start += len;
+    lb->scan = lb->start;
+    return len;
+}
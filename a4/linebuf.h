@@ -0,0 +1,37 @@
+#ifndef _LINEBUF_H_
+#define _LINEBUF_H_
+
+// Capacity of a line buffer; must be a power of two. The longest line
+// that can be received is two bytes shorter, to leave room for \r\n.
+#define LINEBUF_SIZE 256
+
+struct pool;
+
+/* A ring buffer that splits a client's input into lines ending in a
+ * network newline (\r\n). start, end and scan count bytes from the
+ * beginning of the stream and are reduced modulo LINEBUF_SIZE only to
+ * index data, so end - start is always the number of bytes held.
+ *
+ * Most input arrives as whole lines that are handled as soon as they
+ * are read, so data is leased from a pool of LINEBUF_SIZE byte buffers
+ * shared by the clients of a thread, and given back whenever nothing is
+ * held. An idle connection then has no buffer at all.
+ */
+struct line_buf {
+    char *data;             // The leased buffer, or NULL if none
+    unsigned int start;     // First byte of the line being received
+    unsigned int end;       // One past the last byte received
+    unsigned int scan;      // First byte not yet searched for a newline
+    int cr;                 // 1 if the byte before scan was '\r'
+    int discarding;         // 1 while skipping the rest of an overlong line
+};
+
+void linebuf_init(struct line_buf *lb);
+int linebuf_read(struct line_buf *lb, int fd, struct pool *pool);
+int linebuf_put(struct line_buf *lb, const char *data, int len, struct pool *pool);
+void linebuf_done(struct line_buf *lb, struct pool *pool);
+void linebuf_clear(struct line_buf *lb, struct pool *pool);
+int linebuf_next(struct line_buf *lb, char *line);
+int linebuf_frame(struct line_buf *lb, char *frame);
+
+#endif
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+
+#include "gameplay.h"
+#include "benchutil.h"
+
+#ifndef PORT
+    #define PORT 56480
+#endif
+
+/*
+ * Loopback TCP against Unix domain socket benchmark for wordsrv.
+ *
+ * Runs the same load over each transport in turn: a number of clients
+ * sit at the name prompt, each repeatedly sending an empty name and
+ * waiting for the server to reject it, so every message is one read and
+ * one reply for the server and nothing else. Reports the round trip
+ * latency, the rate, and the CPU time spent per message by this process
+ * and, given the server's process id with -P, by the server.
+ *
+ * Usage: localbench -U socket_path [-h host] [-p port] [-c clients]
+ *                   [-r rounds] [-P server_pid]
+ *
+ * The server must be started with -L socket_path.
+ */
+
+#define DEFAULT_CLIENTS 1
+#define DEFAULT_ROUNDS 20000
+#define REJECT_MSG "Your name?\r\n"
+
+struct conn {
+    int fd;
+    char buf[MAX_BUF];
+    int len;
+    double sent_at;
+};
+
+double *samples;
+
+void send_round(struct conn *c) {
+    c->sent_at = now_usec();
+    if (write(c->fd, "\r\n", 2) != 2) {
+        perror("write");
+        exit(1);
+    }
+}
+
+/*
+ * Read what has arrived for c. Returns 1 once the rejection is complete.
+ */
+int read_round(struct conn *c) {
+    int reject_len = strlen(REJECT_MSG);
+    int n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+    if (n <= 0) {
+        fprintf(stderr, "server closed a connection\n");
+        exit(1);
+    }
+    c->len += n;
+    // The reply always ends with the prompt, so it is complete once the
+    // last bytes seen match it
+    if (c->len >= reject_len &&
+        memcmp(c->buf + c->len - reject_len, REJECT_MSG, reject_len) == 0) {
+        c->len = 0;
+        return 1;
+    }
+    if (c->len == sizeof(c->buf)) {
+        c->len = 0;
+    }
+    return 0;
+}
+
+/*
+ * Run rounds round trips spread over num_clients clients connected to
+ * addr, and print a line of results for the transport called name.
+ */
+void run(const char *name, struct sockaddr *addr, socklen_t len,
+         int num_clients, int rounds, int server_pid) {
+    struct conn *clients = calloc(num_clients, sizeof(struct conn));
+    struct pollfd *fds = calloc(num_clients, sizeof(struct pollfd));
+    if (clients == NULL || fds == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < num_clients; i++) {
+        clients[i].fd = connect_client(addr, len);
+        fds[i].fd = clients[i].fd;
+        fds[i].events = POLLIN;
+    }
+
+    // Warm up before timing
+    for (int i = 0; i < rounds / 10; i++) {
+        struct conn *c = &clients[i % num_clients];
+        send_round(c);
+        while (!read_round(c))
+            ;
+    }
+
+    double start = now_usec();
+    double self_start = self_cpu_usec();
+    double server_start = server_pid ? proc_cpu_usec(server_pid) : -1;
+    int sent = 0, done = 0;
+    for (int i = 0; i < num_clients && sent < rounds; i++) {
+        send_round(&clients[i]);
+        sent++;
+    }
+    while (done < rounds) {
+        if (poll(fds, num_clients, -1) < 0) {
+            perror("poll");
+            exit(1);
+        }
+        double now = now_usec();
+        for (int i = 0; i < num_clients; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            struct conn *c = &clients[i];
+            if (read_round(c)) {
+                samples[done++] = now - c->sent_at;
+                if (sent < rounds) {
+                    send_round(c);
+                    sent++;
+                }
+            }
+        }
+    }
+    double elapsed = now_usec() - start;
+    double self_cpu = self_cpu_usec() - self_start;
+    double server_cpu = (server_start >= 0) ? proc_cpu_usec(server_pid) - server_start : -1;
+
+    qsort(samples, rounds, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (int i = 0; i < rounds; i++) {
+        sum += samples[i];
+    }
+    printf("%-9s %10d %10.0f %9.1f %9.1f %9.1f %12.2f ", name, rounds,
+           rounds / (elapsed / 1e6), sum / rounds, samples[rounds / 2],
+           samples[(long)(rounds * 0.99)], self_cpu / rounds);
+    if (server_cpu >= 0) {
+        printf("%12.2f\n", server_cpu / rounds);
+    } else {
+        printf("%12s\n", "-");
+    }
+
+    for (int i = 0; i < num_clients; i++) {
+        close(clients[i].fd);
+    }
+    free(clients);
+    free(fds);
+}
+
+int main(int argc, char **argv) {
+    char *host = "127.0.0.1";
+    int port = PORT;
+    char *path = NULL;
+    int num_clients = DEFAULT_CLIENTS;
+    int rounds = DEFAULT_ROUNDS;
+    int server_pid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:U:c:r:P:")) != -1) {
+        switch (opt) {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            break;
+        case 'U':
+            path = optarg;
+            break;
+        case 'c':
+            num_clients = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            rounds = strtol(optarg, NULL, 10);
+            break;
+        case 'P':
+            server_pid = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s -U socket_path [-h host] [-p port] [-c clients] "
+                    "[-r rounds] [-P server_pid]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (path == NULL || num_clients <= 0 || rounds <= 0) {
+        fprintf(stderr, "Usage: %s -U socket_path [-h host] [-p port] [-c clients] "
+                "[-r rounds] [-P server_pid]\n", argv[0]);
+        exit(1);
+    }
+
+    struct sockaddr_in in_addr;
+    memset(&in_addr, 0, sizeof(in_addr));
+    in_addr.sin_family = AF_INET;
+    in_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &in_addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", host);
+        exit(1);
+    }
+    struct sockaddr_un un_addr;
+    memset(&un_addr, 0, sizeof(un_addr));
+    un_addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(un_addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(un_addr.sun_path, path);
+
+    samples = malloc(rounds * sizeof(double));
+    if (samples == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    printf("%-9s %10s %10s %9s %9s %9s %12s %12s\n", "", "rounds", "rounds/s",
+           "mean usec", "p50", "p99", "cpu/round", "server cpu");
+    run("tcp", (struct sockaddr *)&in_addr, sizeof(in_addr), num_clients, rounds, server_pid);
+    // Give the server a moment to process the disconnects
+    usleep(200000);
+    run("unix", (struct sockaddr *)&un_addr, sizeof(un_addr), num_clients, rounds, server_pid);
+    return 0;
+}
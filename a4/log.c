@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+
+// Lines each thread can have waiting to be written
+#define LOG_SLOTS 1024
+// Longest line kept; longer lines are truncated
+#define LOG_LINE 128
+// How long the writer thread sleeps when there is nothing to write
+#define LOG_IDLE_NSEC 2000000
+
+/* Lines logged by one thread that have not been written yet. Only the
+ * owning thread advances head and only the writer thread advances tail,
+ * so neither side needs a lock.
+ */
+struct log_ring {
+    struct log_ring *next;
+    unsigned int head;          // Next slot to fill
+    unsigned int tail;          // Next slot to write out
+    unsigned long dropped;      // Lines lost because the ring was full
+    unsigned long reported;     // Drops already reported (writer only)
+    char slots[LOG_SLOTS][LOG_LINE];
+};
+
+volatile int log_level = LOG_INFO;
+
+// Every thread's ring, pushed on when the thread first logs
+static struct log_ring *rings = NULL;
+static __thread struct log_ring *my_ring = NULL;
+
+// Put at the start of every line, to tell processes sharing stdout apart
+static char prefix[16] = "";
+
+/*
+ * Return the calling thread's ring, creating it on first use.
+ */
+static struct log_ring *get_ring(void) {
+    if (my_ring == NULL) {
+        struct log_ring *r = calloc(1, sizeof(struct log_ring));
+        if (r == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        r->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            ;
+        my_ring = r;
+    }
+    return my_ring;
+}
+
+/*
+ * Format a line into the calling thread's ring. If the writer has fallen
+ * behind and the ring is full, the line is dropped and counted instead
+ * of blocking the caller.
+ */
+void log_write(const char *format, ...) {
+    struct log_ring *r = get_ring();
+    unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (r->head - tail == LOG_SLOTS) {
+        __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    char *slot = r->slots[r->head % LOG_SLOTS];
+    int len = strlen(prefix);
+    memcpy(slot, prefix, len);
+    va_list args;
+    va_start(args, format);
+    len += vsnprintf(slot + len, LOG_LINE - len, format, args);
+    va_end(args);
+
+    // A truncated line still ends the line
+    if (len >= LOG_LINE) {
+        slot[LOG_LINE - 2] = '\n';
+    }
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Write out everything waiting in every ring. Returns the number of
+ * lines written.
+ */
+static int drain(void) {
+    int written = 0;
+    for (struct log_ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+         r != NULL; r = r->next) {
+        unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        unsigned int tail = r->tail;
+        for (; tail != head; tail++) {
+            fputs(r->slots[tail % LOG_SLOTS], stdout);
+            written++;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+        unsigned long dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if (dropped != r->reported) {
+            printf("log: dropped %lu lines\n", dropped - r->reported);
+            r->reported = dropped;
+            written++;
+        }
+    }
+    if (written > 0) {
+        fflush(stdout);
+    }
+    return written;
+}
+
+/*
+ * Body of the writer thread.
+ */
+static void *log_main(void *arg) {
+    struct timespec idle = {0, LOG_IDLE_NSEC};
+    while (1) {
+        if (drain() == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Set the verbosity and start the thread that writes logged lines to
+ * stdout. Nothing logged before this is lost, it just waits in its ring.
+ */
+void log_start(int level) {
+    pthread_t thread;
+    log_level = level;
+    if (pthread_create(&thread, NULL, log_main, NULL) != 0) {
+        fprintf(stderr, "Could not start the log thread\n");
+        exit(1);
+    }
+    pthread_detach(thread);
+}
+
+/*
+ * Start every line logged from now on with the given prefix, which is
+ * cut short if it is too long. Call it before any thread logs.
+ */
+void log_set_prefix(const char *p) {
+    snprintf(prefix, sizeof(prefix), "%s", p);
+}
+
+/*
+ * Move to the next more verbose level, wrapping around to errors only.
+ * Safe to call from a signal handler.
+ */
+void log_cycle_level(void) {
+    log_level = (log_level + 1) % (LOG_DEBUG + 1);
+}
+
+/*
+ * Wait until the writer thread has written out every line logged so far,
+ * for a process that is about to exit.
+ */
+void log_flush(void) {
+    struct timespec idle = {0, LOG_IDLE_NSEC};
+    for (struct log_ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+         r != NULL; r = r->next) {
+        while (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) !=
+               __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    // The last lines taken may still be on their way to stdout
+    nanosleep(&idle, NULL);
+}
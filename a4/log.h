@@ -0,0 +1,29 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+// Log levels, from least to most verbose
+#define LOG_ERROR 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+
+// The current verbosity; messages above it are skipped
+extern volatile int log_level;
+
+/* Log a printf-style message at the given level. The arguments are not
+ * evaluated at all unless the level is enabled.
+ */
+#define log_msg(level, ...) \
+    do { \
+        if ((level) <= log_level) { \
+            log_write(__VA_ARGS__); \
+        } \
+    } while (0)
+
+void log_start(int level);
+void log_write(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+void log_set_prefix(const char *prefix);
+void log_cycle_level(void);
+void log_flush(void);
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "loop.h"
+
+/*
+ * Create the epoll instance that the server's event loop waits on.
+ * Terminates with exit code 1 on failure.
+ */
+int loop_create(void) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    return epfd;
+}
+
+/*
+ * Start watching fd for the given events. ptr is handed back in the
+ * data field of every event reported for fd, so the caller never has
+ * to search for the owner of a ready descriptor. Returns 0 on success
+ * and -1 if fd cannot be watched, for example because the kernel's limit
+ * on watched descriptors was reached; the caller should then close just
+ * that connection.
+ */
+int loop_add(int epfd, int fd, void *ptr, unsigned int events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = ptr;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl add");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Change the set of events watched for fd. Returns 0 on success and -1
+ * on failure, after which fd's events can no longer be relied on.
+ */
+int loop_mod(int epfd, int fd, void *ptr, unsigned int events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = ptr;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        perror("epoll_ctl mod");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stop watching fd. Must be called before fd is closed, since a
+ * duplicated descriptor would otherwise keep it registered. An fd that
+ * was never watched, because loop_add failed, is not an error.
+ */
+void loop_del(int epfd, int fd) {
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) < 0 && errno != ENOENT) {
+        perror("epoll_ctl del");
+    }
+}
+
+/*
+ * Wait for at most MAX_EVENTS ready descriptors, blocking for at most
+ * timeout milliseconds (-1 blocks indefinitely). Returns the number of
+ * events stored in events, 0 if the wait was interrupted by a signal.
+ */
+int loop_wait(int epfd, struct epoll_event *events, int timeout) {
+    int nready = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+    if (nready < 0) {
+        if (errno != EINTR) {
+            perror("epoll_wait");
+        }
+        return 0;
+    }
+    return nready;
+}
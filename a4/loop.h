@@ -0,0 +1,15 @@
+#ifndef _LOOP_H_
+#define _LOOP_H_
+
+#include <sys/epoll.h>
+
+// Maximum number of ready descriptors handled per call to loop_wait
+#define MAX_EVENTS 64
+
+int loop_create(void);
+int loop_add(int epfd, int fd, void *ptr, unsigned int events);
+int loop_mod(int epfd, int fd, void *ptr, unsigned int events);
+void loop_del(int epfd, int fd);
+int loop_wait(int epfd, struct epoll_event *events, int timeout);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+/*
+ * Return the time in microseconds on a clock that never jumps.
+ */
+unsigned long clock_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Return the bucket that value is counted in.
+ */
+static int bucket_of(unsigned long value) {
+    if (value < HIST_SUB) {
+        return value;
+    }
+    int msb = 63 - __builtin_clzl(value);
+    if (msb > 31) {
+        return HIST_BUCKETS - 1;
+    }
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)(value >> shift) - HIST_SUB;
+}
+
+/*
+ * Return the smallest value counted in bucket i, and set *high to the
+ * largest.
+ */
+static unsigned long bucket_range(int i, unsigned long *high) {
+    if (i < HIST_SUB) {
+        *high = i;
+        return i;
+    }
+    int shift = i / HIST_SUB - 1;
+    unsigned long low = (unsigned long)(HIST_SUB + i % HIST_SUB) << shift;
+    *high = low + (1UL << shift) - 1;
+    return low;
+}
+
+/*
+ * Count value in h, which only the calling thread may write.
+ */
+void hist_record(struct hist *h, unsigned long value) {
+    int i = bucket_of(value);
+    __atomic_store_n(&h->counts[i], h->counts[i] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + value, __ATOMIC_RELAXED);
+    if (value > h->max) {
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Add the counts of src, which another thread may be writing, to dst.
+ */
+void hist_merge(struct hist *dst, struct hist *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+    }
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (max > dst->max) {
+        dst->max = max;
+    }
+}
+
+/*
+ * Return the value below which a fraction p of the values in h fall, to
+ * within the width of its bucket.
+ */
+static unsigned long percentile(struct hist *h, double p) {
+    unsigned long total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        total += h->counts[i];
+    }
+    unsigned long want = p * total;
+    unsigned long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > want) {
+            unsigned long high;
+            bucket_range(i, &high);
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+/*
+ * Print a summary line for h, then one line for each bucket that holds
+ * any values: its name with _bucket, the range it covers and its count.
+ */
+void hist_print(FILE *fp, const char *name, struct hist *h) {
+    fprintf(fp, "%s count=%lu mean=%.1f p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n",
+            name, h->count, h->count ? (double)h->sum / h->count : 0.0,
+            percentile(h, 0.5), percentile(h, 0.9), percentile(h, 0.99),
+            percentile(h, 0.999), h->max);
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (h->counts[i] != 0) {
+            unsigned long high;
+            unsigned long low = bucket_range(i, &high);
+            fprintf(fp, "%s_bucket %lu-%lu %lu\n", name, low, high, h->counts[i]);
+        }
+    }
+}
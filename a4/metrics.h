@@ -0,0 +1,57 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdio.h>
+
+/* Counters and histograms are each written by one thread only, the shard
+ * or acceptor that owns them, and read by the admin thread while they
+ * change. Writes are relaxed atomic stores rather than read-modify-write
+ * operations, so the event loops never lock or contend for anything; a
+ * report may be a moment out of date but never sees a torn value.
+ */
+
+// Add n to a counter written only by the calling thread
+#define stat_add(counter, n) \
+    __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+// Read a counter that another thread may be writing
+#define stat_get(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+// Each power of two is split into this many buckets (as a power of two),
+// so a value is placed within 1/8 of itself
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+// Values up to 2^32 are kept apart; anything larger goes in the last bucket
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/* A log-linear histogram in the style of HdrHistogram: values below
+ * HIST_SUB get a bucket each, and each power of two above that is split
+ * into HIST_SUB equal buckets. Recording a value is a few instructions
+ * and needs no allocation.
+ */
+struct hist {
+    unsigned long counts[HIST_BUCKETS];
+    unsigned long count;
+    unsigned long sum;
+    unsigned long max;
+};
+
+// The metrics of one shard, written only by its thread
+struct shard_stats {
+    unsigned long bytes_in;     // Bytes read from clients
+    unsigned long bytes_out;    // Bytes written to clients
+    unsigned long writes;       // writev calls
+    unsigned long lines;        // Lines of input handled
+    struct hist events;         // Ready events per loop iteration
+    struct hist loop_usec;      // Time to handle one loop iteration
+    struct hist guess_usec;     // From reading a player's line to writing
+                                // the replies to it
+    struct hist outq_bytes;     // Output still queued after each flush
+};
+
+unsigned long clock_usec(void);
+void hist_record(struct hist *h, unsigned long value);
+void hist_merge(struct hist *dst, struct hist *src);
+void hist_print(FILE *fp, const char *name, struct hist *h);
+
+#endif
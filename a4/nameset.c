@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gameplay.h"
+#include "nameset.h"
+
+// Marks a slot whose client was removed; probes continue past it
+static char tombstone;
+#define TOMBSTONE ((struct client *)&tombstone)
+
+/*
+ * Return the FNV-1a hash of name.
+ */
+static unsigned int hash_name(const char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name != '\0'; name++) {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Allocate cap empty slots for set.
+ */
+static void alloc_slots(struct name_set *set, unsigned int cap) {
+    set->slots = calloc(cap, sizeof(struct name_slot));
+    if (set->slots == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    set->cap = cap;
+    set->used = 0;
+    set->tombs = 0;
+}
+
+/*
+ * Initialize an empty set.
+ */
+void nameset_init(struct name_set *set) {
+    alloc_slots(set, NAMESET_INIT);
+}
+
+/*
+ * Put p in the first free slot for hash, without checking for duplicates
+ * or growing the set.
+ */
+static void insert(struct name_set *set, unsigned int hash, struct client *p) {
+    unsigned int mask = set->cap - 1;
+    unsigned int i = hash & mask;
+    while (set->slots[i].client != NULL && set->slots[i].client != TOMBSTONE) {
+        i = (i + 1) & mask;
+    }
+    if (set->slots[i].client == TOMBSTONE) {
+        set->tombs--;
+    }
+    set->slots[i].hash = hash;
+    set->slots[i].client = p;
+    set->used++;
+}
+
+/*
+ * Rehash every client into cap slots, dropping the tombstones.
+ */
+static void resize(struct name_set *set, unsigned int cap) {
+    struct name_slot *old = set->slots;
+    unsigned int old_cap = set->cap;
+
+    alloc_slots(set, cap);
+    for (unsigned int i = 0; i < old_cap; i++) {
+        if (old[i].client != NULL && old[i].client != TOMBSTONE) {
+            insert(set, old[i].hash, old[i].client);
+        }
+    }
+    free(old);
+}
+
+/*
+ * Return 1 if a client in set has the given name, 0 otherwise.
+ */
+int nameset_contains(struct name_set *set, const char *name) {
+    unsigned int hash = hash_name(name);
+    unsigned int mask = set->cap - 1;
+
+    for (unsigned int i = hash & mask; set->slots[i].client != NULL; i = (i + 1) & mask) {
+        struct name_slot *slot = &set->slots[i];
+        if (slot->client != TOMBSTONE && slot->hash == hash &&
+            strcmp(slot->client->name, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Add client p, under its current name, to set. The set is kept at most
+ * three quarters full, counting tombstones, so probes stay short.
+ */
+void nameset_add(struct name_set *set, struct client *p) {
+    if ((set->used + set->tombs + 1) * 4 > set->cap * 3) {
+        // Only grow if the clients themselves need the room
+        resize(set, (set->used + 1) * 2 > set->cap ? set->cap * 2 : set->cap);
+    }
+    insert(set, hash_name(p->name), p);
+}
+
+/*
+ * Remove client p from set, if it is there.
+ */
+void nameset_remove(struct name_set *set, struct client *p) {
+    unsigned int hash = hash_name(p->name);
+    unsigned int mask = set->cap - 1;
+
+    for (unsigned int i = hash & mask; set->slots[i].client != NULL; i = (i + 1) & mask) {
+        if (set->slots[i].client == p) {
+            set->slots[i].client = TOMBSTONE;
+            set->used--;
+            set->tombs++;
+            return;
+        }
+    }
+}
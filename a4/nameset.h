@@ -0,0 +1,32 @@
+#ifndef _NAMESET_H_
+#define _NAMESET_H_
+
+struct client;
+
+// Slots in a new set; must be a power of two
+#define NAMESET_INIT 16
+
+// One slot: empty, a tombstone left by a removal, or a client
+struct name_slot {
+    unsigned int hash;
+    struct client *client;
+};
+
+/* The names of the players in one game, so a new name is checked with
+ * one probe sequence instead of a walk of the player list. Open
+ * addressing with linear probing; the names themselves stay in the
+ * clients, which must not be renamed or freed while in the set.
+ */
+struct name_set {
+    struct name_slot *slots;
+    unsigned int cap;       // Number of slots, a power of two
+    unsigned int used;      // Slots holding a client
+    unsigned int tombs;     // Slots holding a tombstone
+};
+
+void nameset_init(struct name_set *set);
+int nameset_contains(struct name_set *set, const char *name);
+void nameset_add(struct name_set *set, struct client *p);
+void nameset_remove(struct name_set *set, struct client *p);
+
+#endif
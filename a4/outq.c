@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "outq.h"
+
+__thread struct outq_stats outq_stats;
+
+/*
+ * Return a new message holding a copy of the len bytes at data, with one
+ * reference owned by the caller.
+ */
+struct msg *msg_new(const char *data, int len) {
+    struct msg *m = malloc(sizeof(struct msg) + len);
+    if (m == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    m->refs = 1;
+    m->len = len;
+    memcpy(m->data, data, len);
+
+    outq_stats.msgs_formatted++;
+    outq_stats.bytes_formatted += len;
+    return m;
+}
+
+/*
+ * Drop one reference to m, freeing it when none are left.
+ */
+void msg_unref(struct msg *m) {
+    if (--m->refs == 0) {
+        free(m);
+    }
+}
+
+/*
+ * Initialize an empty queue.
+ */
+void outq_init(struct out_queue *q) {
+    q->head = NULL;
+    q->tail = NULL;
+    q->offset = 0;
+    q->bytes = 0;
+}
+
+/*
+ * Append m to the end of q. The queue takes its own reference, so the
+ * caller keeps theirs.
+ */
+void outq_push(struct out_queue *q, struct msg *m) {
+    struct out_chunk *c = malloc(sizeof(struct out_chunk));
+    if (c == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    c->next = NULL;
+    c->msg = m;
+    m->refs++;
+
+    if (q->tail == NULL) {
+        q->head = c;
+    } else {
+        q->tail->next = c;
+    }
+    q->tail = c;
+    q->bytes += m->len;
+    outq_stats.bytes_queued += m->len;
+}
+
+/*
+ * Remove the chunk at the head of q and release its message.
+ */
+static void outq_pop(struct out_queue *q) {
+    struct out_chunk *done = q->head;
+    q->head = done->next;
+    if (q->head == NULL) {
+        q->tail = NULL;
+    }
+    q->offset = 0;
+    msg_unref(done->msg);
+    free(done);
+}
+
+/*
+ * Describe the unwritten part of the oldest chunks of q, at most max of
+ * them, in iov. Returns the number of entries filled in. The memory they
+ * point to stays valid until the bytes are consumed or q is cleared.
+ */
+int outq_peek(struct out_queue *q, struct iovec *iov, int max) {
+    int n = 0;
+    for (struct out_chunk *c = q->head; c != NULL && n < max; c = c->next) {
+        iov[n].iov_base = c->msg->data;
+        iov[n].iov_len = c->msg->len;
+        n++;
+    }
+    if (n > 0) {
+        iov[0].iov_base = q->head->msg->data + q->offset;
+        iov[0].iov_len = q->head->msg->len - q->offset;
+    }
+    return n;
+}
+
+/*
+ * Drop the first written bytes of q, which the socket has accepted.
+ */
+void outq_consume(struct out_queue *q, int written) {
+    q->bytes -= written;
+    outq_stats.bytes_sent += written;
+
+    // Release every chunk that was written in full
+    while (q->head != NULL && written >= q->head->msg->len - q->offset) {
+        written -= q->head->msg->len - q->offset;
+        outq_pop(q);
+    }
+    q->offset += written;
+}
+
+/*
+ * Write as much of q to the non-blocking socket fd as it will take, using
+ * one writev per OUTQ_IOV chunks. Returns the number of bytes still queued
+ * (0 once the queue is empty), or -1 if the write failed for any reason
+ * other than the socket buffer being full.
+ */
+int outq_flush(struct out_queue *q, int fd) {
+    struct iovec iov[OUTQ_IOV];
+
+    while (q->head != NULL) {
+        int n = outq_peek(q, iov, OUTQ_IOV);
+        ssize_t written = writev(fd, iov, n);
+        outq_stats.writes++;
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // After a partial write, the next writev reports whether the
+        // socket buffer is actually full
+        outq_consume(q, written);
+    }
+    return q->bytes;
+}
+
+/*
+ * Discard everything in q.
+ */
+void outq_clear(struct out_queue *q) {
+    while (q->head != NULL) {
+        outq_pop(q);
+    }
+    outq_init(q);
+}
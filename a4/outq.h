@@ -0,0 +1,55 @@
+#ifndef _OUTQ_H_
+#define _OUTQ_H_
+
+#include <sys/uio.h>
+
+// Number of queued chunks handed to a single writev call
+#define OUTQ_IOV 64
+
+/* An immutable, reference counted message. It is formatted once and the
+ * same bytes are queued for every recipient; it is freed when the last
+ * queue holding it has written it out.
+ */
+struct msg {
+    int refs;
+    int len;
+    char data[];
+};
+
+// A message waiting to be written to a client
+struct out_chunk {
+    struct out_chunk *next;
+    struct msg *msg;
+};
+
+// Outbound messages for one client, oldest first
+struct out_queue {
+    struct out_chunk *head;
+    struct out_chunk *tail;
+    int offset;     // Bytes of head already written
+    int bytes;      // Total bytes still to be written
+};
+
+// Totals across all clients of one thread, for comparing work done
+// formatting messages with the bytes actually delivered
+struct outq_stats {
+    long msgs_formatted;    // Messages built
+    long bytes_formatted;   // Bytes in the messages built
+    long bytes_queued;      // Bytes attached to client queues
+    long bytes_sent;        // Bytes accepted by the sockets
+    long writes;            // writev calls made, or sends submitted
+};
+
+extern __thread struct outq_stats outq_stats;
+
+struct msg *msg_new(const char *data, int len);
+void msg_unref(struct msg *m);
+
+void outq_init(struct out_queue *q);
+void outq_push(struct out_queue *q, struct msg *m);
+int outq_peek(struct out_queue *q, struct iovec *iov, int max);
+void outq_consume(struct out_queue *q, int written);
+int outq_flush(struct out_queue *q, int fd);
+void outq_clear(struct out_queue *q);
+
+#endif
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "metrics.h"
+
+// Objects are aligned for anything they may hold, as malloc's are; a
+// slab from malloc is aligned the same way
+#define POOL_ALIGN 16
+
+/*
+ * Initialize an empty pool of objects of size bytes.
+ */
+void pool_init(struct pool *pool, size_t size) {
+    if (size < sizeof(void *)) {
+        size = sizeof(void *);
+    }
+    pool->size = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    pool->free = NULL;
+    pool->next = NULL;
+    pool->end = NULL;
+    pool->used = 0;
+    pool->slab_bytes = 0;
+}
+
+/*
+ * Return an object from pool, uninitialized. Freed objects are reused
+ * first, then the rest of the newest slab, and only then is another slab
+ * allocated. Terminates if memory runs out, as malloc failures do
+ * everywhere else.
+ */
+void *pool_get(struct pool *pool) {
+    void *obj;
+
+    if (pool->free != NULL) {
+        obj = pool->free;
+        pool->free = *(void **)obj;
+    } else {
+        if (pool->next == NULL || pool->next + pool->size > pool->end) {
+            size_t bytes = POOL_SLAB_SIZE;
+            if (bytes < pool->size) {
+                bytes = pool->size;
+            }
+            pool->next = malloc(bytes);
+            if (pool->next == NULL) {
+                perror("malloc");
+                exit(1);
+            }
+            pool->end = pool->next + bytes;
+            stat_add(pool->slab_bytes, bytes);
+        }
+        obj = pool->next;
+        pool->next += pool->size;
+    }
+    stat_add(pool->used, 1);
+    return obj;
+}
+
+/*
+ * Give obj, which came from pool, back to it.
+ */
+void pool_put(struct pool *pool, void *obj) {
+    *(void **)obj = pool->free;
+    pool->free = obj;
+    stat_add(pool->used, -1);
+}
@@ -0,0 +1,32 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+
+// Bytes carved into objects each time a pool runs out
+#define POOL_SLAB_SIZE (64 * 1024)
+
+/* A pool of fixed-size objects, carved out of large slabs so that each
+ * object costs exactly its size, with no allocator header, and objects
+ * of one kind sit together in memory. A freed object goes on a free list
+ * threaded through the object itself and is the next one handed out, so
+ * a busy pool keeps reusing the same few warm objects. Slabs are kept
+ * for the life of the pool.
+ *
+ * A pool belongs to one thread. used and slab_bytes are also stored
+ * with relaxed atomics, so other threads may read them for reports.
+ */
+struct pool {
+    size_t size;            // Bytes per object
+    void *free;             // Freed objects, linked through their first word
+    char *next;             // Next object never handed out in the newest
+    char *end;              // slab, and the end of that slab
+    long used;              // Objects handed out and not yet put back
+    long slab_bytes;        // Bytes of slabs allocated
+};
+
+void pool_init(struct pool *pool, size_t size);
+void *pool_get(struct pool *pool);
+void pool_put(struct pool *pool, void *obj);
+
+#endif
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "record.h"
+#include "log.h"
+
+// Bytes of events each thread can have waiting to be written; must be a
+// power of two
+#define REC_RING_SIZE (1 << 20)
+// How often the file is flushed to disk, in microseconds
+#define FLUSH_USEC 1000000
+// How long the writer thread sleeps when there is nothing to write
+#define REC_IDLE_NSEC 2000000
+
+/* Events recorded by one thread that have not been written yet, each a
+ * struct rec_event followed by its data, packed end to end and wrapping
+ * around the end of data. head and tail count bytes from the start and
+ * are reduced modulo REC_RING_SIZE only to index data. Only the owning
+ * thread advances head and only the writer thread advances tail, so
+ * neither side needs a lock.
+ *
+ * busy is set while the owner stamps an event and adds it, so that the
+ * writer can tell when every event stamped before a given moment is in
+ * its ring.
+ */
+struct rec_ring {
+    struct rec_ring *next;
+    unsigned long head;         // Next byte to fill
+    unsigned long tail;         // Next byte to write out
+    int busy;
+    char data[REC_RING_SIZE];
+};
+
+volatile int recording = 0;
+
+static FILE *rec_fp;
+static uint64_t rec_start;      // When the recording started
+static uint64_t rec_flushed;    // When the file was last flushed (writer only)
+static int rec_dirty;           // 1 if events were written since then
+
+// Every thread's ring, pushed on when the thread first records
+static struct rec_ring *rings = NULL;
+static __thread struct rec_ring *my_ring = NULL;
+// Events dropped because a ring was full
+static unsigned long dropped = 0;
+
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Return the calling thread's ring, creating it on first use.
+ */
+static struct rec_ring *get_ring(void) {
+    if (my_ring == NULL) {
+        struct rec_ring *r = calloc(1, sizeof(struct rec_ring));
+        if (r == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        r->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            ;
+        my_ring = r;
+    }
+    return my_ring;
+}
+
+/*
+ * Copy len bytes into r at byte position pos, wrapping around its end.
+ */
+static void ring_put(struct rec_ring *r, unsigned long pos, const void *src, int len) {
+    unsigned int at = pos & (REC_RING_SIZE - 1);
+    unsigned int first = REC_RING_SIZE - at;
+    if ((unsigned int)len <= first) {
+        memcpy(r->data + at, src, len);
+    } else {
+        memcpy(r->data + at, src, first);
+        memcpy(r->data, (const char *)src + first, len - first);
+    }
+}
+
+/*
+ * Copy len bytes out of r from byte position pos, wrapping around its end.
+ */
+static void ring_get(struct rec_ring *r, unsigned long pos, void *dst, int len) {
+    unsigned int at = pos & (REC_RING_SIZE - 1);
+    unsigned int first = REC_RING_SIZE - at;
+    if ((unsigned int)len <= first) {
+        memcpy(dst, r->data + at, len);
+    } else {
+        memcpy(dst, r->data + at, first);
+        memcpy((char *)dst + first, r->data, len - first);
+    }
+}
+
+/*
+ * Stop recording, leaving what has been written so far as a complete
+ * recording of the session up to that point. Writer thread only.
+ */
+static void stop_recording(const char *why) {
+    __atomic_store_n(&recording, 0, __ATOMIC_RELAXED);
+    log_msg(LOG_ERROR, "Stopped recording: %s\n", why);
+    fflush(rec_fp);
+}
+
+/*
+ * Write out, in the order they were stamped, every event in every ring
+ * stamped before now. Returns the number of events written, or -1 once
+ * the recording has stopped.
+ */
+static int drain(void) {
+    // Any event stamped before cutoff was being added when the ring was
+    // marked busy, so once no ring is busy every such event is in place
+    uint64_t cutoff = now_usec() - rec_start;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    struct timespec pause = {0, 1000};
+    for (struct rec_ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+         r != NULL; r = r->next) {
+        while (__atomic_load_n(&r->busy, __ATOMIC_SEQ_CST)) {
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    if (__atomic_load_n(&dropped, __ATOMIC_RELAXED) > 0) {
+        // A recording with events missing would not replay faithfully
+        stop_recording("a thread recorded faster than it could be written");
+        return -1;
+    }
+
+    // Merge the rings: each is in order already, so repeatedly take the
+    // earliest event at the front of any of them
+    int written = 0;
+    while (1) {
+        struct rec_ring *first = NULL;
+        struct rec_event e, best;
+        for (struct rec_ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+             r != NULL; r = r->next) {
+            if (r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+            ring_get(r, r->tail, &e, sizeof(e));
+            if (e.usec < cutoff && (first == NULL || e.usec < best.usec)) {
+                first = r;
+                best = e;
+            }
+        }
+        if (first == NULL) {
+            break;
+        }
+
+        char data[UINT16_MAX];
+        ring_get(first, first->tail + sizeof(best), data, best.len);
+        __atomic_store_n(&first->tail, first->tail + sizeof(best) + best.len,
+                         __ATOMIC_RELEASE);
+        if (fwrite(&best, sizeof(best), 1, rec_fp) != 1 ||
+            (best.len > 0 && fwrite(data, best.len, 1, rec_fp) != 1)) {
+            stop_recording("could not write to the file");
+            return -1;
+        }
+        written++;
+        rec_dirty = 1;
+    }
+
+    uint64_t now = now_usec();
+    if (rec_dirty && now - rec_flushed >= FLUSH_USEC) {
+        if (fflush(rec_fp) != 0) {
+            stop_recording("could not write to the file");
+            return -1;
+        }
+        rec_flushed = now;
+        rec_dirty = 0;
+    }
+    return written;
+}
+
+/*
+ * Body of the writer thread.
+ */
+static void *record_main(void *arg) {
+    struct timespec idle = {0, REC_IDLE_NSEC};
+    int written;
+    while ((written = drain()) >= 0) {
+        if (written == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Start recording to filename, which is created or truncated, and start
+ * the thread that writes it. Returns 0 on success, and -1 with a message
+ * on stderr if it cannot be written.
+ */
+int record_open(const char *filename, unsigned int seed, int shards) {
+    struct rec_header h;
+    pthread_t thread;
+
+    rec_fp = fopen(filename, "wb");
+    if (rec_fp == NULL) {
+        perror(filename);
+        return -1;
+    }
+    memcpy(h.magic, REC_MAGIC, sizeof(h.magic));
+    h.version = REC_VERSION;
+    h.seed = seed;
+    h.shards = shards;
+    if (fwrite(&h, sizeof(h), 1, rec_fp) != 1) {
+        perror("fwrite");
+        fclose(rec_fp);
+        return -1;
+    }
+    rec_start = rec_flushed = now_usec();
+    recording = 1;
+    if (pthread_create(&thread, NULL, record_main, NULL) != 0) {
+        fprintf(stderr, "Could not start the recording thread\n");
+        fclose(rec_fp);
+        recording = 0;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/*
+ * Record an event on connection fd, with the len bytes at data if it is
+ * REC_INPUT. Safe to call from any thread, and never blocks: the event
+ * goes into the calling thread's ring, and the writer thread writes the
+ * events of every thread out in the order they were stamped. The file is
+ * flushed about once a second, so a recording cut off by a crash loses
+ * at most the last second or so. If the writer falls so far behind that
+ * a ring fills up, or the file cannot be written, recording stops and
+ * the file holds the session up to that point.
+ */
+void record_event(int type, int fd, const char *data, int len) {
+    struct rec_ring *r = get_ring();
+    struct rec_event e;
+
+    e.fd = fd;
+    e.len = (type == REC_INPUT) ? len : 0;
+    e.type = type;
+    e.pad = 0;
+
+    unsigned long tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (r->head - tail + sizeof(e) + e.len > REC_RING_SIZE) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Marked busy before the clock is read, so the writer never misses
+    // an event stamped before it looked
+    __atomic_store_n(&r->busy, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    e.usec = now_usec() - rec_start;
+    ring_put(r, r->head, &e, sizeof(e));
+    if (e.len > 0) {
+        ring_put(r, r->head + sizeof(e), data, e.len);
+    }
+    __atomic_store_n(&r->head, r->head + sizeof(e) + e.len, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->busy, 0, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,49 @@
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include <stdint.h>
+
+/* A recorded wordsrv session is a header followed by one record per
+ * event, each input record followed by its len bytes of data:
+ *
+ *     struct rec_header
+ *     struct rec_event, [data]
+ *     struct rec_event, [data]
+ *     ...
+ *
+ * Connections are named by their descriptor in the recording server,
+ * which is unique between a connection's REC_CONNECT and its REC_CLOSE.
+ * All integers are in host byte order.
+ */
+
+#define REC_MAGIC "WREC"
+#define REC_VERSION 1
+
+struct rec_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t seed;          // Seed of the room word generators
+    uint32_t shards;        // Number of shards the server ran
+};
+
+enum rec_type {
+    REC_CONNECT,            // A connection was accepted
+    REC_INPUT,              // Bytes were read from a connection
+    REC_CLOSE               // A connection was closed, by either side
+};
+
+struct rec_event {
+    uint64_t usec;          // Time since the recording started
+    int32_t fd;
+    uint16_t len;           // Bytes of data following a REC_INPUT
+    uint8_t type;
+    uint8_t pad;
+};
+
+int record_open(const char *filename, unsigned int seed, int shards);
+void record_event(int type, int fd, const char *data, int len);
+
+// 1 while a recording is being made
+extern volatile int recording;
+
+#endif
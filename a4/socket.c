@@ -1,12 +1,30 @@
+#define _GNU_SOURCE        /* accept4 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>   /* TCP_INFO */
 #include <arpa/inet.h>     /* inet_ntoa */
 #include <netdb.h>         /* gethostname */
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/sock_diag.h>  /* SK_MEMINFO_DROPS */
 
 #include "socket.h"
+#include "log.h"
+#include "metrics.h"
+#include "uring.h"
+
+// Marks the completions of the multishot accept in its ring
+static struct uring_op accept_op;
+
+struct accept_stats accept_stats;
+
+// A descriptor held in reserve, so that a connection can still be
+// accepted and closed when the process runs out of descriptors
+static int spare_fd = -1;
 
 /*
  * Initialize a server address associated with the given port.
@@ -31,10 +49,13 @@ struct sockaddr_in *init_server_addr(int port) {
 
 
 /*
- * Create and set up a socket for a server to listen on.
+ * Create and set up a socket for a server to listen on. If reuseport is
+ * set, other processes may bind their own sockets to the same port, and
+ * the kernel spreads incoming connections across all of them.
  */
-int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
-    int soc = socket(PF_INET, SOCK_STREAM, 0);
+int set_up_server_socket(struct sockaddr_in *self, int num_queue, int reuseport) {
+    // Non-blocking, so the acceptor can drain the queue until it is empty
+    int soc = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (soc < 0) {
         perror("socket");
         exit(1);
@@ -49,6 +70,10 @@ int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
         perror("setsockopt");
         exit(1);
     }
+    if (reuseport && setsockopt(soc, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        perror("setsockopt");
+        exit(1);
+    }
 
     // Associate the process with the address and a port
     if (bind(soc, (struct sockaddr *)self, sizeof(*self)) < 0) {
@@ -69,26 +94,389 @@ int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
 
 
 /*
- * Wait for and accept a new connection.
- * Terminate with exit code 1 if the accept call failed, otherwise return
- * the client's socket descriptor.
+ * Clear the address of a peer that did not connect over IPv4, which is
+ * then stored as INADDR_ANY, an address no TCP client can have.
+ */
+static void local_peer(struct sockaddr_in *peer) {
+    if (peer->sin_family != AF_INET) {
+        memset(peer, 0, sizeof(*peer));
+    }
+}
+
+/*
+ * Return the address of a client as text, for logging. Clients of the
+ * local socket are called "local".
+ */
+const char *peer_name(struct in_addr addr) {
+    if (addr.s_addr == htonl(INADDR_ANY)) {
+        return "local";
+    }
+    return inet_ntoa(addr);
+}
+
+/*
+ * Accept a connection waiting on the non-blocking socket listenfd and
+ * store the client's address in peer, which is cleared for a client of
+ * the local socket. The client's socket is non-blocking and closed on
+ * exec.
+ *
+ * Connections that fail before they are accepted are skipped. When the
+ * process is out of descriptors, the spare one is given up to accept the
+ * connection and close it, so it does not sit in the queue keeping
+ * listenfd readable.
+ *
+ * Return the client's socket descriptor, or -1 once no connection is
+ * waiting or on an error that accepting again would not cure.
+ */
+int accept_connection(int listenfd, struct sockaddr_in *peer) {
+    socklen_t peer_len = sizeof(*peer);
+
+    if (spare_fd == -1) {
+        spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    while (1) {
+        int client_socket = accept4(listenfd, (struct sockaddr *)peer, &peer_len,
+                                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket >= 0) {
+            local_peer(peer);
+            stat_add(accept_stats.accepted, 1);
+            log_msg(LOG_DEBUG, "New connection accepted from %s:%d\n",
+                    peer_name(peer->sin_addr), ntohs(peer->sin_port));
+            return client_socket;
+        }
+
+        switch (errno) {
+        case EAGAIN:
+            return -1;
+        case EINTR:
+            break;
+        case ECONNABORTED:
+        case EPROTO:
+            stat_add(accept_stats.aborted, 1);
+            break;
+        case EMFILE:
+        case ENFILE:
+            if (spare_fd == -1) {
+                return -1;
+            }
+            close(spare_fd);
+            // accept fails this way even when the queue is empty
+            client_socket = accept(listenfd, NULL, NULL);
+            if (client_socket >= 0) {
+                close(client_socket);
+                stat_add(accept_stats.shed, 1);
+                log_msg(LOG_ERROR, "Out of descriptors; turned a connection away\n");
+            }
+            spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (client_socket < 0) {
+                return -1;
+            }
+            break;
+        default:
+            perror("accept");
+            return -1;
+        }
+        peer_len = sizeof(*peer);
+    }
+}
+
+/*
+ * Ask ring to accept connections on listenfd as they arrive, each one
+ * reported by a completion that accept_completed takes, until the
+ * request fails or is cancelled. No system call is made until ring is
+ * next submitted.
+ */
+void accept_multishot(struct uring *ring, int listenfd) {
+    struct io_uring_sqe *sqe = uring_sqe(ring, &accept_op);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+/*
+ * Stop ring accepting connections on listenfd. Connections it has
+ * already accepted are still returned by accept_completed.
+ */
+void accept_cancel(struct uring *ring) {
+    struct io_uring_sqe *sqe = uring_sqe(ring, NULL);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (unsigned long)&accept_op;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    uring_submit(ring);
+}
+
+/*
+ * Take the next connection accepted by accept_multishot on listenfd and
+ * store the client's address in peer. The counters and the handling of
+ * failures are those of accept_connection. The request is renewed if it
+ * ended, unless it was cancelled.
+ *
+ * Return the client's socket descriptor, or -1 once no accepted
+ * connection is waiting. No system call is made unless one is returned.
+ */
+int accept_completed(struct uring *ring, int listenfd, struct sockaddr_in *peer) {
+    struct io_uring_cqe *cqe;
+
+    while ((cqe = uring_peek(ring)) != NULL) {
+        int res = cqe->res;
+        int more = cqe->flags & IORING_CQE_F_MORE;
+        int mine = (cqe->user_data == (unsigned long)&accept_op);
+        uring_seen(ring);
+        if (!mine) {
+            continue;
+        }
+        if (!more && res != -ECANCELED) {
+            accept_multishot(ring, listenfd);
+            uring_submit(ring);
+        }
+
+        if (res >= 0) {
+            socklen_t peer_len = sizeof(*peer);
+            // The request was given nowhere to store addresses, since
+            // several connections may arrive before any is taken
+            if (getpeername(res, (struct sockaddr *)peer, &peer_len) < 0) {
+                memset(peer, 0, sizeof(*peer));
+            }
+            local_peer(peer);
+            stat_add(accept_stats.accepted, 1);
+            log_msg(LOG_DEBUG, "New connection accepted from %s:%d\n",
+                    peer_name(peer->sin_addr), ntohs(peer->sin_port));
+            return res;
+        }
+
+        switch (-res) {
+        case ECANCELED:
+            break;
+        case ECONNABORTED:
+        case EPROTO:
+            stat_add(accept_stats.aborted, 1);
+            break;
+        case EMFILE:
+        case ENFILE:
+            // Shed the connection that could not be accepted
+            res = accept_connection(listenfd, peer);
+            if (res >= 0) {
+                return res;
+            }
+            break;
+        default:
+            errno = -res;
+            perror("accept");
+        }
+    }
+    return -1;
+}
+
+
+/*
+ * Return the number of connections waiting to be accepted on listenfd,
+ * or -1 if the kernel does not say.
+ */
+int listen_queue_depth(int listenfd) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    // For a listening socket, unacked is the length of the accept queue
+    if (getsockopt(listenfd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return -1;
+    }
+    return info.tcpi_unacked;
+}
+
+
+/*
+ * Return the number of connections listening socket listenfd has
+ * dropped, mostly because its accept queue was full, or -1 if the
+ * kernel does not say. Unlike the host-wide ListenOverflows counter in
+ * /proc/net/netstat, this counts only this socket.
+ */
+long listen_drops(int listenfd) {
+    unsigned int meminfo[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(meminfo);
+
+    if (getsockopt(listenfd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+        len <= SK_MEMINFO_DROPS * sizeof(unsigned int)) {
+        return -1;
+    }
+    return meminfo[SK_MEMINFO_DROPS];
+}
+
+
+/*
+ * Fill in the address of the Unix domain socket at path.
+ * Terminate with exit code 1 if path is too long.
+ */
+static void init_unix_addr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(addr->sun_path, path);
+}
+
+
+/*
+ * Create a socket at path for a newer server process to connect to and
+ * take over from this one. Each record sent over it stays a separate
+ * message. A socket left at path by an earlier process is replaced.
+ */
+int set_up_upgrade_socket(const char *path) {
+    struct sockaddr_un addr;
+    init_unix_addr(&addr, path);
+
+    int soc = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (soc < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    unlink(path);
+    if (bind(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+    if (listen(soc, 1) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    return soc;
+}
+
+
+/*
+ * Create a socket at path for clients on this host to connect to instead
+ * of going through TCP, set up like the one from set_up_server_socket.
+ * A socket left at path by an earlier process is replaced.
+ */
+int set_up_local_socket(const char *path, int num_queue) {
+    struct sockaddr_un addr;
+    init_unix_addr(&addr, path);
+
+    int soc = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (soc < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    unlink(path);
+    if (bind(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+    if (listen(soc, num_queue) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    return soc;
+}
+
+/*
+ * Create a stream socket at path for local tools to ask the server for
+ * its metrics. A socket left at path by an earlier process is replaced.
+ */
+int set_up_admin_socket(const char *path) {
+    struct sockaddr_un addr;
+    init_unix_addr(&addr, path);
+
+    int soc = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (soc < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    unlink(path);
+    if (bind(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(1);
+    }
+    if (listen(soc, 16) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    return soc;
+}
+
+/*
+ * Connect to the upgrade socket of a running server at path.
+ * Return -1 if no server is listening there.
  */
-int accept_connection(int listenfd) {
-    struct sockaddr_in peer;
-    unsigned int peer_len = sizeof(peer);
-    peer.sin_family = PF_INET;
+int connect_upgrade_socket(const char *path) {
+    struct sockaddr_un addr;
+    init_unix_addr(&addr, path);
 
-    printf("Waiting for a new connection...\n");
-    int client_socket = accept(listenfd, (struct sockaddr *)&peer, &peer_len);
-    if (client_socket < 0) {
-        perror("accept");
+    int soc = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (soc < 0) {
+        perror("socket");
         exit(1);
-    } else {
-        printf("New connection accepted from %s:%d\n",
-            inet_ntoa(peer.sin_addr),
-            ntohs(peer.sin_port));
-        return client_socket;
     }
+    if (connect(soc, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(soc);
+        return -1;
+    }
+    return soc;
+}
+
+
+/*
+ * Send len bytes from buf as one message on sock, passing a duplicate of
+ * descriptor fd along with them unless fd is -1.
+ * Return the number of bytes sent, or -1 on error.
+ */
+int send_with_fd(int sock, const void *buf, int len, int fd) {
+    struct iovec iov = {(void *)buf, len};
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr mh;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (fd != -1) {
+        mh.msg_control = control.space;
+        mh.msg_controllen = sizeof(control.space);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &mh, 0);
 }
 
 
+/*
+ * Receive one message of at most len bytes from sock into buf. *fd is
+ * set to the descriptor passed with it, or -1 if there was none.
+ * Return the number of bytes received, 0 at end of file, or -1 on error.
+ */
+int recv_with_fd(int sock, void *buf, int len, int *fd) {
+    struct iovec iov = {buf, len};
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr mh;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.space;
+    mh.msg_controllen = sizeof(control.space);
+
+    *fd = -1;
+    int n = recvmsg(sock, &mh, 0);
+    if (n <= 0) {
+        return n;
+    }
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    if (cm != NULL && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cm), sizeof(int));
+    }
+    return n;
+}
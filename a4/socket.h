@@ -3,8 +3,33 @@
 
 #include <netinet/in.h>    /* Internet domain header, for struct sockaddr_in */
 
+// Counters kept by accept_connection. Only the acceptor thread writes
+// them; the admin thread reads them.
+struct accept_stats {
+    long accepted;      // Connections accepted
+    long aborted;       // Connections reset before they could be accepted
+    long shed;          // Connections closed for lack of descriptors
+};
+
+extern struct accept_stats accept_stats;
+
 struct sockaddr_in *init_server_addr(int port);
-int set_up_server_socket(struct sockaddr_in *self, int num_queue);
-int accept_connection(int listenfd);
+int set_up_server_socket(struct sockaddr_in *self, int num_queue, int reuseport);
+int accept_connection(int listenfd, struct sockaddr_in *peer);
+const char *peer_name(struct in_addr addr);
+int listen_queue_depth(int listenfd);
+
+struct uring;
+void accept_multishot(struct uring *ring, int listenfd);
+void accept_cancel(struct uring *ring);
+int accept_completed(struct uring *ring, int listenfd, struct sockaddr_in *peer);
+long listen_drops(int listenfd);
+
+int set_up_upgrade_socket(const char *path);
+int connect_upgrade_socket(const char *path);
+int set_up_local_socket(const char *path, int num_queue);
+int set_up_admin_socket(const char *path);
+int send_with_fd(int sock, const void *buf, int len, int fd);
+int recv_with_fd(int sock, void *buf, int len, int *fd);
 
 #endif
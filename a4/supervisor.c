@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "supervisor.h"
+
+// A worker that dies within this many seconds of starting is restarted
+// only after the same delay, so one that cannot start does not spin
+#define RESPAWN_SECS 1
+
+struct worker {
+    pid_t pid;              // 0 while it is not running
+    time_t started;
+    time_t respawn_at;      // When to start it again, or 0 if never
+};
+
+static struct worker *workers;
+static int num_workers;
+static pid_t supervisor_pid;
+// The signal mask to give back to a worker, apart from SIGHUP and SIGUSR1
+static sigset_t worker_mask;
+
+/*
+ * Start worker i. Returns 1 in the new worker, 0 in the supervisor.
+ */
+static int start_worker(int i) {
+    struct worker *w = &workers[i];
+    time_t now = time(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        w->respawn_at = now + RESPAWN_SECS;
+        return 0;
+    }
+    if (pid == 0) {
+        // A worker is not left serving on its own if the supervisor dies,
+        // even if that happened before it could ask
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != supervisor_pid) {
+            exit(1);
+        }
+        // SIGHUP and SIGUSR1 stay blocked: one passed on before the worker
+        // has set up its own handling would kill it, so it unblocks them
+        // once it has
+        sigset_t mask = worker_mask;
+        sigaddset(&mask, SIGHUP);
+        sigaddset(&mask, SIGUSR1);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        return 1;
+    }
+    w->pid = pid;
+    w->started = now;
+    w->respawn_at = 0;
+    printf("Started worker %d as process %d\n", i, pid);
+    fflush(stdout);
+    return 0;
+}
+
+/*
+ * Send sig to every running worker.
+ */
+static void signal_workers(int sig) {
+    for (int i = 0; i < num_workers; i++) {
+        if (workers[i].pid != 0) {
+            kill(workers[i].pid, sig);
+        }
+    }
+}
+
+/*
+ * Collect every worker that has exited, and decide when to start each
+ * one again. One that exits with status 0 has handed its connections
+ * over to a new server and is not replaced, and nothing is replaced
+ * while stopping.
+ */
+static void reap_workers(int stopping) {
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        int i;
+        for (i = 0; i < num_workers && workers[i].pid != pid; i++)
+            ;
+        if (i == num_workers) {
+            continue;
+        }
+        struct worker *w = &workers[i];
+        time_t now = time(NULL);
+        w->pid = 0;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            printf("Worker %d exited\n", i);
+        } else if (WIFSIGNALED(status)) {
+            printf("Worker %d was killed by signal %d\n", i, WTERMSIG(status));
+        } else {
+            printf("Worker %d failed with status %d\n", i, WEXITSTATUS(status));
+        }
+        fflush(stdout);
+
+        if (stopping || (WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+            w->respawn_at = 0;
+        } else if (now - w->started < RESPAWN_SECS) {
+            w->respawn_at = now + RESPAWN_SECS;
+        } else {
+            w->respawn_at = now;
+        }
+    }
+}
+
+/*
+ * Fork count workers and look after them. In each worker this returns
+ * the worker's index, from 0 to count - 1, with the signal mask it was
+ * called with plus SIGHUP and SIGUSR1, which the worker unblocks once it
+ * can handle them. In the supervisor it never returns: SIGHUP and SIGUSR1
+ * are passed on to every worker, SIGTERM and SIGINT stop them all, and
+ * a worker that crashes is started again without disturbing the rest.
+ * The supervisor exits once no worker is running or due to be.
+ */
+int supervise(int count) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    // Blocked before the first fork, so nothing is missed while starting
+    if (sigprocmask(SIG_BLOCK, &mask, &worker_mask) < 0) {
+        perror("sigprocmask");
+        exit(1);
+    }
+
+    supervisor_pid = getpid();
+    num_workers = count;
+    workers = calloc(count, sizeof(struct worker));
+    if (workers == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    fflush(stdout);
+    for (int i = 0; i < count; i++) {
+        if (start_worker(i)) {
+            return i;
+        }
+    }
+
+    int stopping = 0;
+    while (1) {
+        // Sleep until a signal comes in or a worker is due to be started
+        time_t now = time(NULL);
+        time_t due = 0;
+        int running = 0;
+        for (int i = 0; i < num_workers; i++) {
+            if (workers[i].pid != 0) {
+                running = 1;
+            } else if (workers[i].respawn_at != 0 &&
+                       (due == 0 || workers[i].respawn_at < due)) {
+                due = workers[i].respawn_at;
+            }
+        }
+        if (!running && due == 0) {
+            printf("No workers left; exiting\n");
+            exit(0);
+        }
+
+        int sig;
+        if (due == 0) {
+            sig = sigwaitinfo(&mask, NULL);
+        } else {
+            struct timespec ts = {due > now ? due - now : 0, 0};
+            sig = sigtimedwait(&mask, NULL, &ts);
+        }
+
+        switch (sig) {
+        case SIGCHLD:
+            reap_workers(stopping);
+            break;
+        case SIGHUP:
+        case SIGUSR1:
+            signal_workers(sig);
+            break;
+        case SIGTERM:
+        case SIGINT:
+            printf("Stopping all workers\n");
+            fflush(stdout);
+            stopping = 1;
+            for (int i = 0; i < num_workers; i++) {
+                workers[i].respawn_at = 0;
+            }
+            signal_workers(SIGTERM);
+            break;
+        }
+
+        now = time(NULL);
+        for (int i = 0; i < num_workers; i++) {
+            struct worker *w = &workers[i];
+            if (w->pid == 0 && w->respawn_at != 0 && w->respawn_at <= now) {
+                if (start_worker(i)) {
+                    return i;
+                }
+            }
+        }
+    }
+}
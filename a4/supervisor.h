@@ -0,0 +1,11 @@
+#ifndef _SUPERVISOR_H_
+#define _SUPERVISOR_H_
+
+/* A supervisor process that runs a number of workers as forked copies of
+ * itself. supervise only returns in a worker, with that worker's index;
+ * the supervisor stays inside it, starting a new worker in place of any
+ * that crashes, and exits once every worker has exited cleanly.
+ */
+int supervise(int workers);
+
+#endif
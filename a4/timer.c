@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "timer.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+// Index of tick t in the slots of level l
+#define INDEX(t, l) (((t) >> ((l) * TIMER_BITS)) & SLOT_MASK)
+
+/*
+ * Return milliseconds on the monotonic clock.
+ */
+unsigned long timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Initialize an empty wheel starting at the current time.
+ */
+void timer_wheel_init(struct timer_wheel *w) {
+    for (int l = 0; l < TIMER_LEVELS; l++) {
+        for (int i = 0; i < TIMER_SLOTS; i++) {
+            w->slots[l][i] = NULL;
+        }
+    }
+    w->now = timer_now_ms() / TIMER_TICK_MS;
+    w->pending = 0;
+}
+
+/*
+ * Initialize a timer that is not pending.
+ */
+void timer_init(struct timer *t, void (*fn)(struct timer *t)) {
+    t->next = NULL;
+    t->pprev = NULL;
+    t->fn = fn;
+}
+
+/*
+ * Link t into the slot for its expiry time.
+ */
+static void place(struct timer_wheel *w, struct timer *t) {
+    unsigned long delta = t->expires - w->now;
+    int level = 0;
+
+    // Find the lowest level whose turn covers the delay
+    while (level < TIMER_LEVELS - 1 &&
+           delta >= (1UL << ((level + 1) * TIMER_BITS))) {
+        level++;
+    }
+    // Anything beyond the top level is clamped to its longest delay
+    if (delta >= (1UL << (TIMER_LEVELS * TIMER_BITS))) {
+        t->expires = w->now + (1UL << (TIMER_LEVELS * TIMER_BITS)) - 1;
+    }
+
+    struct timer **slot = &w->slots[level][INDEX(t->expires, level)];
+    t->level = level;
+    t->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->pprev = &t->next;
+    }
+    t->pprev = slot;
+    *slot = t;
+}
+
+/*
+ * Unlink t from its slot.
+ */
+static void unlink_timer(struct timer *t) {
+    *t->pprev = t->next;
+    if (t->next != NULL) {
+        t->next->pprev = t->pprev;
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/*
+ * Arm t to fire delay_ms from now, replacing any earlier expiry.
+ */
+void timer_add(struct timer_wheel *w, struct timer *t, unsigned long delay_ms) {
+    unsigned long current = timer_now_ms() / TIMER_TICK_MS;
+
+    if (t->pprev != NULL) {
+        unlink_timer(t);
+    } else {
+        // The wheel only moves while something is pending, so after an
+        // idle spell now may be far behind; with nothing to fire it can
+        // simply jump to the present
+        if (w->pending == 0 && w->now < current) {
+            w->now = current;
+        }
+        w->pending++;
+    }
+    // Count from the clock rather than from now, which lags behind it
+    // until the next timer_run. Round up, and add a tick since the
+    // current one is already partly over, so a timer never fires early;
+    // and never place it in the slot being processed, which could fire
+    // it again straight away.
+    unsigned long ticks = (delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    t->expires = current + ticks + 1;
+    if (t->expires <= w->now) {
+        t->expires = w->now + 1;
+    }
+    place(w, t);
+}
+
+/*
+ * Stop t from firing. Does nothing if it is not pending.
+ */
+void timer_cancel(struct timer_wheel *w, struct timer *t) {
+    if (t->pprev != NULL) {
+        unlink_timer(t);
+        w->pending--;
+    }
+}
+
+/*
+ * Return 1 if t is waiting to fire and 0 otherwise.
+ */
+int timer_pending(struct timer *t) {
+    return t->pprev != NULL;
+}
+
+/*
+ * Move every timer in slot index of level down to where it now belongs.
+ * Returns index, so that the caller knows whether this level has also
+ * started a new turn.
+ */
+static int cascade(struct timer_wheel *w, int level, int index) {
+    struct timer *t = w->slots[level][index];
+    w->slots[level][index] = NULL;
+    while (t != NULL) {
+        struct timer *next = t->next;
+        place(w, t);
+        t = next;
+    }
+    return index;
+}
+
+/*
+ * Fire every timer that has expired by now. A timer is unlinked before
+ * its function is called, so the function may add it again or add and
+ * cancel any other timer.
+ */
+void timer_run(struct timer_wheel *w) {
+    unsigned long target = timer_now_ms() / TIMER_TICK_MS;
+
+    // With nothing pending there is nothing to step through
+    if (w->pending == 0) {
+        if (w->now <= target) {
+            w->now = target + 1;
+        }
+        return;
+    }
+
+    while (w->now <= target) {
+        int index = INDEX(w->now, 0);
+        // At the start of each turn of a level, pull down the next slot
+        // of the level above it
+        if (index == 0) {
+            for (int l = 1; l < TIMER_LEVELS &&
+                 cascade(w, l, INDEX(w->now, l)) == 0; l++)
+                ;
+        }
+
+        struct timer **slot = &w->slots[0][index];
+        while (*slot != NULL) {
+            struct timer *t = *slot;
+            unlink_timer(t);
+            w->pending--;
+            t->fn(t);
+        }
+        w->now++;
+    }
+}
+
+/*
+ * Return how many milliseconds the event loop may sleep before timer_run
+ * has work to do, or -1 if no timer is pending. Only the rest of the
+ * current turn of level 0 is searched; if it is empty the loop wakes at
+ * the end of the turn, when the next cascade happens.
+ */
+int timer_timeout(struct timer_wheel *w) {
+    if (w->pending == 0) {
+        return -1;
+    }
+
+    unsigned long tick = w->now;
+    do {
+        if (w->slots[0][INDEX(tick, 0)] != NULL) {
+            break;
+        }
+        tick++;
+    } while (INDEX(tick, 0) != 0);
+
+    long wait = (long)(tick * TIMER_TICK_MS) - (long)timer_now_ms();
+    return wait > 0 ? wait : 0;
+}
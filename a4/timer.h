@@ -0,0 +1,42 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+// Resolution of the timer wheel in milliseconds
+#define TIMER_TICK_MS 10
+#define TIMER_LEVELS 4
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+
+/* A timer that calls fn once when it expires. Embed it in the structure
+ * it belongs to and recover that structure in fn with offsetof.
+ */
+struct timer {
+    struct timer *next;
+    struct timer **pprev;       // Link that points to this timer; NULL
+                                // when the timer is not pending
+    unsigned long expires;      // Tick at which the timer fires
+    int level;
+    void (*fn)(struct timer *t);
+};
+
+/* A hierarchical timing wheel. Level 0 has one slot per tick; each slot
+ * of a higher level covers a whole turn of the level below, and its
+ * timers are moved down a level ("cascaded") when that turn starts.
+ * Adding, cancelling and firing a timer are all O(1).
+ */
+struct timer_wheel {
+    unsigned long now;          // Next tick to process
+    struct timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+    int pending;                // Number of pending timers
+};
+
+unsigned long timer_now_ms(void);
+void timer_wheel_init(struct timer_wheel *w);
+void timer_init(struct timer *t, void (*fn)(struct timer *t));
+void timer_add(struct timer_wheel *w, struct timer *t, unsigned long delay_ms);
+void timer_cancel(struct timer_wheel *w, struct timer *t);
+int timer_pending(struct timer *t);
+void timer_run(struct timer_wheel *w);
+int timer_timeout(struct timer_wheel *w);
+
+#endif
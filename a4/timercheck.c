@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "timer.h"
+
+/*
+ * Checks that timers armed on a timing wheel never fire early, however
+ * long the wheel has gone without timer_run, both when it was idle and
+ * when other timers were pending. The event loop only runs the wheel
+ * after handling a batch of events, so a timer armed while handling them
+ * must count from the clock, not from when the wheel last moved.
+ *
+ * Usage: timercheck
+ *
+ * Exits with status 1 if any timer fires early.
+ */
+
+struct probe {
+    struct timer t;             // First, so the timer is the probe
+    unsigned long armed;        // When it was armed, in ms
+    unsigned long delay;        // What it was armed for, in ms
+    unsigned long fired;        // When it fired, or 0
+};
+
+int failures = 0;
+
+void probe_fired(struct timer *t) {
+    struct probe *p = (struct probe *)t;
+    p->fired = timer_now_ms();
+}
+
+void ignore_fired(struct timer *t) {
+}
+
+/*
+ * Arm p for delay ms on w, run the wheel until it fires, and report
+ * whether it fired early.
+ */
+void check(const char *name, struct timer_wheel *w, struct probe *p,
+           unsigned long delay) {
+    timer_init(&p->t, probe_fired);
+    p->armed = timer_now_ms();
+    p->delay = delay;
+    p->fired = 0;
+    timer_add(w, &p->t, delay);
+
+    // The loop handles the rest of its events before running the wheel
+    timer_run(w);
+    while (p->fired == 0) {
+        poll(NULL, 0, timer_timeout(w));
+        timer_run(w);
+    }
+
+    unsigned long took = p->fired - p->armed;
+    int early = took < delay;
+    printf("%-28s delay %5lu ms  fired after %5lu ms  %s\n", name, delay, took,
+           early ? "EARLY" : "ok");
+    if (early) {
+        failures++;
+    }
+}
+
+int main(void) {
+    struct timer_wheel w;
+    struct probe p;
+    struct timer other;
+
+    timer_wheel_init(&w);
+
+    // Nothing pending: the wheel has not moved since it was created
+    usleep(1500000);
+    check("after idle", &w, &p, 100);
+    usleep(700000);
+    check("after idle, short delay", &w, &p, 5);
+
+    // Something pending far off, but the wheel not run for a while, as
+    // when a batch of events takes long to handle
+    timer_init(&other, ignore_fired);
+    timer_add(&w, &other, 60000);
+    timer_run(&w);
+    usleep(700000);
+    check("behind with timers pending", &w, &p, 50);
+    usleep(300000);
+    check("behind, no delay", &w, &p, 0);
+    timer_cancel(&w, &other);
+
+    for (unsigned long delay = 1; delay <= 1000; delay *= 3) {
+        usleep(delay * 250);
+        check("varied", &w, &p, delay);
+    }
+
+    if (failures > 0) {
+        printf("%d timers fired early\n", failures);
+        return 1;
+    }
+    printf("no timer fired early\n");
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Live upgrade under load. Starts wordsrv with an upgrade socket, runs a
+# swarm of wordbot players against it, and part way through starts a
+# second wordsrv on the same socket, which takes everything over. Exits
+# with status 1 if any bot was disconnected, if the old process did not
+# hand over and exit, or if the new one is not left serving.
+#
+# Usage: upgradecheck.sh [bots] [seconds]
+#
+# Run from this directory after make; the servers use the port wordbot
+# was built with.
+
+BOTS=${1:-200}
+SECONDS_RUN=${2:-6}
+DICT=dictionary.txt
+SOCK=/tmp/upgradecheck.$$.sock
+LOG=/tmp/upgradecheck.$$.log
+
+fail() {
+    echo "upgradecheck: $*"
+    kill $OLD $NEW 2>/dev/null
+    rm -f $SOCK
+    exit 1
+}
+
+./wordsrv -t 2 -u $SOCK $DICT > $LOG.old 2>&1 &
+OLD=$!
+sleep 0.5
+kill -0 $OLD 2>/dev/null || fail "first server did not start"
+
+# -g exits 1 if any bot is disconnected; the latency limit is left loose,
+# since the handover itself stalls every game for a moment
+./wordbot -n $BOTS -d $SECONDS_RUN -g 10000000 > $LOG 2>&1 &
+BOT=$!
+sleep $((SECONDS_RUN / 2))
+
+./wordsrv -t 2 -u $SOCK $DICT > $LOG.new 2>&1 &
+NEW=$!
+
+wait $BOT
+STATUS=$?
+cat $LOG
+
+sleep 0.5
+kill -0 $OLD 2>/dev/null && fail "old server is still running"
+kill -0 $NEW 2>/dev/null || fail "new server is not running"
+grep "Took over" $LOG.new
+[ $STATUS -eq 0 ] || fail "bots saw a disconnect or failed"
+
+kill $NEW
+rm -f $SOCK $LOG $LOG.old $LOG.new
+echo "upgradecheck: no bot was disconnected"
+exit 0
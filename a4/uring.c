@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                          unsigned int flags, void *arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Set up r with room for entries requests at a time to be prepared, and
+ * four times that many completions waiting. flags are IORING_SETUP_*
+ * flags. Returns 0 on success, and -1 with errno set if the kernel has
+ * no io_uring or lacks a feature used here, so the caller can fall back
+ * to something else.
+ */
+int uring_init(struct uring *r, unsigned int entries, unsigned int flags) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = flags | IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    r->fd = io_uring_setup(entries, &p);
+    if (r->fd < 0) {
+        return -1;
+    }
+    // One mapping for both rings, completions held rather than dropped
+    // when the queue is full, and waiting with a timeout
+    unsigned int needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                          IORING_FEAT_EXT_ARG;
+    if ((p.features & needed) != needed) {
+        close(r->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t size = sq_size > cq_size ? sq_size : cq_size;
+    char *rings = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       r->fd, IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(rings, size);
+        close(r->fd);
+        return -1;
+    }
+
+    r->sq_head = (unsigned int *)(rings + p.sq_off.head);
+    r->sq_tail = (unsigned int *)(rings + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)(rings + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)(rings + p.sq_off.array);
+    r->sq_flags = (unsigned int *)(rings + p.sq_off.flags);
+    r->sq_entries = p.sq_entries;
+    r->to_submit = 0;
+    r->cq_head = (unsigned int *)(rings + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(rings + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)(rings + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+    r->pending = 0;
+    return 0;
+}
+
+/*
+ * Return a cleared submission queue entry for the caller to fill in,
+ * submitting what is already prepared if the queue is full. Its
+ * completions go to op, or are ignored if op is NULL. The entry is
+ * only read by the kernel at the next submission, so it may be filled
+ * in after this returns.
+ */
+struct io_uring_sqe *uring_sqe(struct uring *r, struct uring_op *op) {
+    unsigned int tail = *r->sq_tail;
+    while (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->sq_entries) {
+        uring_submit(r);
+    }
+
+    unsigned int i = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uintptr_t)op;
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    if (op != NULL) {
+        r->pending++;
+    }
+    return sqe;
+}
+
+/*
+ * Hand every prepared request to the kernel without waiting for any of
+ * them. Returns 0, or -1 if the kernel is out of resources for now and
+ * the rest should be submitted later.
+ */
+int uring_submit(struct uring *r) {
+    while (r->to_submit > 0) {
+        int n = io_uring_enter(r->fd, r->to_submit, 0, 0, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                return -1;
+            }
+            perror("io_uring_enter");
+            exit(1);
+        }
+        r->to_submit -= n;
+    }
+    return 0;
+}
+
+/*
+ * Submit every prepared request and wait for at least one completion,
+ * for at most timeout milliseconds (-1 waits indefinitely, 0 not at
+ * all). Both are done in one system call. Returns the number of
+ * completions ready to be taken with uring_peek or uring_run.
+ */
+int uring_wait(struct uring *r, int timeout) {
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+
+    memset(&arg, 0, sizeof(arg));
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+        arg.ts = (uintptr_t)&ts;
+    }
+    int n = io_uring_enter(r->fd, r->to_submit, timeout == 0 ? 0 : 1,
+                           IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                           &arg, sizeof(arg));
+    if (n >= 0) {
+        r->to_submit -= n;
+    } else if (errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+        perror("io_uring_enter");
+        exit(1);
+    }
+    return __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head;
+}
+
+/*
+ * Return the oldest completion not yet seen, or NULL if there is none.
+ * Completions the kernel held back while the queue was full are moved
+ * into it once it has been emptied.
+ */
+struct io_uring_cqe *uring_peek(struct uring *r) {
+    unsigned int head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (!(__atomic_load_n(r->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)) {
+            return NULL;
+        }
+        io_uring_enter(r->fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+    }
+    return &r->cqes[head & *r->cq_mask];
+}
+
+/*
+ * Give the completion returned by uring_peek back to the kernel.
+ */
+void uring_seen(struct uring *r) {
+    unsigned int head = *r->cq_head;
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    // A multishot request stays pending until a completion without
+    // IORING_CQE_F_MORE
+    if (cqe->user_data != 0 && !(cqe->flags & IORING_CQE_F_MORE)) {
+        r->pending--;
+    }
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Hand every completion ready to the op of its request. An op may
+ * prepare more requests, which go in with the next submission. Returns
+ * the number of completions handled.
+ */
+int uring_run(struct uring *r) {
+    struct io_uring_cqe *cqe;
+    int n = 0;
+
+    while ((cqe = uring_peek(r)) != NULL) {
+        // Copy it out first, so the slot is free for the kernel again
+        struct io_uring_cqe c = *cqe;
+        uring_seen(r);
+        if (c.user_data != 0) {
+            struct uring_op *op = (struct uring_op *)(uintptr_t)c.user_data;
+            op->done(op, &c);
+        }
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Set up b as buffer group group of r, with entries buffers of size
+ * bytes, all of them given to the kernel. Returns 0 on success, and -1
+ * with errno set if the kernel does not support buffer rings.
+ */
+int uring_bufs_init(struct uring *r, struct uring_bufs *b, int group,
+                    unsigned int entries, unsigned int size) {
+    struct io_uring_buf_reg reg;
+
+    // The ring must start on a page boundary
+    if (posix_memalign((void **)&b->ring, sysconf(_SC_PAGESIZE),
+                       entries * sizeof(struct io_uring_buf)) != 0) {
+        perror("posix_memalign");
+        exit(1);
+    }
+    b->data = malloc((size_t)entries * size);
+    if (b->data == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    b->entries = entries;
+    b->size = size;
+    b->tail = 0;
+    b->group = group;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)b->ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    if (io_uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(b->ring);
+        free(b->data);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < entries; i++) {
+        struct io_uring_buf *buf = &b->ring->bufs[i];
+        buf->addr = (uintptr_t)(b->data + (size_t)i * size);
+        buf->len = size;
+        buf->bid = i;
+    }
+    b->tail = entries;
+    __atomic_store_n(&b->ring->tail, b->tail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Return the buffer the data of cqe was received into.
+ */
+char *uring_buf(struct uring_bufs *b, struct io_uring_cqe *cqe) {
+    unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    return b->data + (size_t)bid * b->size;
+}
+
+/*
+ * Give the buffer used by cqe, if any, back to the kernel.
+ */
+void uring_buf_return(struct uring_bufs *b, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        return;
+    }
+    unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    struct io_uring_buf *buf = &b->ring->bufs[b->tail & (b->entries - 1)];
+    buf->addr = (uintptr_t)(b->data + (size_t)bid * b->size);
+    buf->len = b->size;
+    buf->bid = bid;
+    b->tail++;
+    __atomic_store_n(&b->ring->tail, b->tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,65 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <linux/io_uring.h>
+
+/* A minimal io_uring, driven through the raw system calls. Requests are
+ * prepared in the submission queue with uring_sqe and only handed to the
+ * kernel by the next uring_submit or uring_wait, so everything prepared
+ * in one turn of an event loop goes in with a single io_uring_enter.
+ */
+struct uring {
+    int fd;
+    // Submission queue, shared with the kernel
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *sq_flags;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_entries;
+    unsigned int to_submit;     // Prepared but not yet submitted
+    // Completion queue, shared with the kernel
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    int pending;                // Requests with a completion still to come
+};
+
+/* A request whose completions are handed to done by uring_run. Embed it
+ * in the structure it belongs to and recover that structure in done with
+ * offsetof, as with timers.
+ */
+struct uring_op {
+    void (*done)(struct uring_op *op, struct io_uring_cqe *cqe);
+};
+
+/* A ring of equal buffers the kernel picks from when a request with
+ * IOSQE_BUFFER_SELECT receives data, so a connection with nothing to
+ * read holds no buffer. The buffer used is named in the completion and
+ * must be given back with uring_buf_return once its data is consumed.
+ */
+struct uring_bufs {
+    struct io_uring_buf_ring *ring;
+    char *data;
+    unsigned int entries;       // Must be a power of two
+    unsigned int size;          // Bytes in each buffer
+    unsigned short tail;
+    int group;                  // Buffer group id requests select from
+};
+
+int uring_init(struct uring *r, unsigned int entries, unsigned int flags);
+struct io_uring_sqe *uring_sqe(struct uring *r, struct uring_op *op);
+int uring_submit(struct uring *r);
+int uring_wait(struct uring *r, int timeout);
+struct io_uring_cqe *uring_peek(struct uring *r);
+void uring_seen(struct uring *r);
+int uring_run(struct uring *r);
+
+int uring_bufs_init(struct uring *r, struct uring_bufs *b, int group,
+                    unsigned int entries, unsigned int size);
+char *uring_buf(struct uring_bufs *b, struct io_uring_cqe *cqe);
+void uring_buf_return(struct uring_bufs *b, struct io_uring_cqe *cqe);
+
+#endif
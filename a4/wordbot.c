@@ -0,0 +1,474 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+
+#include "gameplay.h"
+#include "benchutil.h"
+#include "binproto.h"
+
+#ifndef PORT
+    #define PORT 56480
+#endif
+
+/*
+ * Bot swarm load generator for wordsrv.
+ *
+ * Opens many connections to a server on this host, answers the name
+ * prompt on each, then plays: whenever a bot is told "Your guess?" it
+ * guesses a letter nobody in its game has tried yet. The time from
+ * sending a guess to the first byte of the server's response is recorded,
+ * and throughput and latency percentiles are reported at the end, along
+ * with the reads made per guess, which roughly counts the separate writes
+ * the server made to deliver its replies.
+ *
+ * With -s, that many more bots connect once the players have, and watch
+ * instead of playing. They only count the updates they are sent, so the
+ * players' latency shows what a crowd of spectators costs them.
+ *
+ * With -b, the players speak the binary protocol instead of text (the
+ * watchers always use text). With -P, the CPU time the server process
+ * spends per guess is reported next to the bots' own.
+ *
+ * Usage: wordbot [-h host] [-p port] [-n bots] [-c connecting] [-d seconds]
+ *                [-g max_p99_usec] [-s watchers] [-b] [-P server_pid]
+ *
+ * With -g, exits with status 1 if the p99 latency is above the limit or
+ * any bot was disconnected, so it can gate a regression check.
+ */
+
+#define DEFAULT_BOTS 100
+#define DEFAULT_SECONDS 10
+// Default number of connections allowed to wait for the welcome message
+// at once, so a large swarm does not overflow the server's listen queue
+#define DEFAULT_CONNECTING 4
+#define MAX_SAMPLES (1 << 22)
+#define TURN_MSG "Your guess?"
+#define NEW_GAME_MSG "Let's start a new game."
+#define WATCH_MSG "Watching: "
+
+enum bot_state { CONNECTING, NAMING, PLAYING, DEAD };
+
+struct bot {
+    int fd;
+    int id;
+    enum bot_state state;
+    char inbuf[MAX_BUF];
+    int inlen;
+    int tried[NUM_LETTERS];   // Letters already guessed in the current game
+    double sent_at;           // When the outstanding guess was sent, or 0
+    int watcher;              // 1 if the bot watches instead of playing
+    int binary;               // 1 if the bot speaks the binary protocol
+};
+
+struct bot *bots;
+int num_bots = DEFAULT_BOTS;
+int num_watchers = 0;
+int epfd;
+int connecting = 0;     // Bots waiting for the welcome message
+int max_connecting = DEFAULT_CONNECTING;
+int next_bot = 0;       // Next bot to connect
+int use_binary = 0;
+
+// Results
+double *samples;
+long num_samples = 0;
+long guesses = 0;
+long bytes_in = 0;
+long reads = 0;         // Reads that returned data, about one per segment
+int disconnects = 0;
+long updates = 0;       // Updates received by watchers
+
+/*
+ * Start a non-blocking connection for the next bot.
+ */
+void connect_bot(struct sockaddr_in *addr) {
+    struct bot *b = &bots[next_bot];
+    b->id = next_bot++;
+    b->watcher = b->id >= num_bots;
+    b->binary = use_binary && !b->watcher;
+    b->inlen = 0;
+    b->sent_at = 0;
+    memset(b->tried, 0, sizeof(b->tried));
+
+    b->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (b->fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    int on = 1;
+    setsockopt(b->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(b->fd, (struct sockaddr *)addr, sizeof(*addr)) < 0 &&
+        errno != EINPROGRESS) {
+        perror("connect");
+        exit(1);
+    }
+    b->state = CONNECTING;
+    connecting++;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = b;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, b->fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+void send_bytes(struct bot *b, const void *data, int len) {
+    if (write(b->fd, data, len) != len) {
+        // The socket buffer cannot be full with this little traffic, so
+        // a short write means the connection is gone
+        b->state = DEAD;
+    }
+}
+
+void send_line(struct bot *b, char *line) {
+    send_bytes(b, line, strlen(line));
+}
+
+/*
+ * Send a binary frame of the given type carrying the len bytes at body.
+ */
+void send_frame(struct bot *b, int type, const void *body, int len) {
+    char buf[BIN_MAX_FRAME];
+    struct bin_hdr *hdr = (struct bin_hdr *)buf;
+    hdr->len = htons(sizeof(*hdr) + len);
+    hdr->type = type;
+    memcpy(buf + sizeof(*hdr), body, len);
+    send_bytes(b, buf, sizeof(*hdr) + len);
+}
+
+/*
+ * Guess a letter that has not been tried in this game.
+ */
+void guess(struct bot *b) {
+    char line[4];
+    // Start from a different letter in each bot so games differ
+    for (int i = 0; i < NUM_LETTERS; i++) {
+        int c = (b->id + i * 7) % NUM_LETTERS;
+        if (!b->tried[c]) {
+            b->tried[c] = 1;
+            b->sent_at = now_usec();
+            guesses++;
+            if (b->binary) {
+                char letter = 'a' + c;
+                send_frame(b, BIN_GUESS, &letter, 1);
+            } else {
+                sprintf(line, "%c\r\n", 'a' + c);
+                send_line(b, line);
+            }
+            return;
+        }
+    }
+    // Every letter is gone; the game must be over, so start again
+    memset(b->tried, 0, sizeof(b->tried));
+    guess(b);
+}
+
+/*
+ * Act on one complete line from the server.
+ */
+void handle_line(struct bot *b, char *line) {
+    char name[MAX_NAME];
+    char c;
+
+    if (b->watcher) {
+        if (strncmp(line, WATCH_MSG, strlen(WATCH_MSG)) == 0) {
+            updates++;
+        }
+    } else if (strcmp(line, TURN_MSG) == 0) {
+        guess(b);
+    } else if (strcmp(line, NEW_GAME_MSG) == 0) {
+        memset(b->tried, 0, sizeof(b->tried));
+    } else if (sscanf(line, "%29s guesses %c.", name, &c) == 2 &&
+               c >= 'a' && c <= 'z') {
+        // Someone else in the game used up this letter
+        b->tried[c - 'a'] = 1;
+    }
+}
+
+/*
+ * Act on one complete frame from the server, for a bot speaking the
+ * binary protocol.
+ */
+void handle_frame(struct bot *b, char *frame) {
+    struct bin_hdr *hdr = (struct bin_hdr *)frame;
+
+    switch (hdr->type) {
+    case BIN_TURN:
+        if (((struct bin_turn *)frame)->yours) {
+            guess(b);
+        }
+        break;
+    case BIN_STATUS: {
+        // Sent on joining and for each new game
+        unsigned int guessed = ntohl(((struct bin_status *)frame)->guessed);
+        for (int i = 0; i < NUM_LETTERS; i++) {
+            b->tried[i] = (guessed >> i) & 1;
+        }
+        break;
+    }
+    case BIN_GUESSED: {
+        char c = ((struct bin_guessed *)frame)->letter;
+        if (c >= 'a' && c <= 'z') {
+            b->tried[c - 'a'] = 1;
+        }
+        break;
+    }
+    }
+}
+
+/*
+ * Split the input of bot b into frames and handle every complete one.
+ * Returns the number of bytes used.
+ */
+int handle_frames(struct bot *b) {
+    int used = 0;
+    while (b->inlen - used >= (int)sizeof(struct bin_hdr)) {
+        struct bin_hdr *hdr = (struct bin_hdr *)(b->inbuf + used);
+        int len = ntohs(hdr->len);
+        if (len < (int)sizeof(struct bin_hdr)) {
+            b->state = DEAD;
+            return used;
+        }
+        if (b->inlen - used < len) {
+            break;
+        }
+        handle_frame(b, b->inbuf + used);
+        used += len;
+    }
+    return used;
+}
+
+/*
+ * Read from bot b and handle every complete line.
+ */
+void handle_input(struct bot *b) {
+    int n = read(b->fd, b->inbuf + b->inlen, sizeof(b->inbuf) - b->inlen - 1);
+    if (n <= 0) {
+        if (n < 0 && errno == EAGAIN) {
+            return;
+        }
+        b->state = DEAD;
+        return;
+    }
+    bytes_in += n;
+    reads++;
+    if (b->sent_at != 0) {
+        if (num_samples < MAX_SAMPLES) {
+            samples[num_samples++] = now_usec() - b->sent_at;
+        }
+        b->sent_at = 0;
+    }
+    b->inlen += n;
+    b->inbuf[b->inlen] = '\0';
+
+    if (b->state == CONNECTING) {
+        if (strstr(b->inbuf, WELCOME_MSG) == NULL) {
+            return;
+        }
+        char line[MAX_NAME + 3];
+        if (b->watcher) {
+            strcpy(line, "/watch\r\n");
+            send_line(b, line);
+        } else if (b->binary) {
+            unsigned char version = BIN_VERSION;
+            send_frame(b, BIN_HELLO, &version, 1);
+            sprintf(line, "bot%d", b->id);
+            send_frame(b, BIN_JOIN, line, strlen(line));
+        } else {
+            sprintf(line, "bot%d\r\n", b->id);
+            send_line(b, line);
+        }
+        b->state = NAMING;
+        b->inlen = 0;
+        connecting--;
+        return;
+    }
+
+    if (b->binary) {
+        b->state = PLAYING;
+        int used = handle_frames(b);
+        b->inlen -= used;
+        memmove(b->inbuf, b->inbuf + used, b->inlen);
+        return;
+    }
+
+    char *start = b->inbuf;
+    char *end;
+    while ((end = strstr(start, "\r\n")) != NULL) {
+        *end = '\0';
+        b->state = PLAYING;
+        handle_line(b, start);
+        start = end + 2;
+    }
+    // Keep the partial line for the next read
+    b->inlen -= start - b->inbuf;
+    memmove(b->inbuf, start, b->inlen);
+    if (b->inlen == sizeof(b->inbuf) - 1) {
+        b->inlen = 0;
+    }
+}
+
+double percentile(double p) {
+    if (num_samples == 0) {
+        return 0;
+    }
+    long i = (long)(p * (num_samples - 1));
+    return samples[i];
+}
+
+int main(int argc, char **argv) {
+    char *host = "127.0.0.1";
+    int port = PORT;
+    int seconds = DEFAULT_SECONDS;
+    double max_p99 = 0;
+    int server_pid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:n:c:d:g:s:bP:")) != -1) {
+        switch (opt) {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            break;
+        case 'n':
+            num_bots = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            max_connecting = strtol(optarg, NULL, 10);
+            break;
+        case 'd':
+            seconds = strtol(optarg, NULL, 10);
+            break;
+        case 'g':
+            max_p99 = strtod(optarg, NULL);
+            break;
+        case 's':
+            num_watchers = strtol(optarg, NULL, 10);
+            break;
+        case 'b':
+            use_binary = 1;
+            break;
+        case 'P':
+            server_pid = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-n bots] "
+                    "[-c connecting] [-d seconds] [-g max_p99_usec] [-s watchers]\n"
+                    "       [-b] [-P server_pid]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (num_bots <= 0 || seconds <= 0 || max_connecting <= 0 || num_watchers < 0) {
+        fprintf(stderr, "Bots, connecting and seconds must be positive\n");
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", host);
+        exit(1);
+    }
+
+    int total = num_bots + num_watchers;
+    bots = calloc(total, sizeof(struct bot));
+    samples = malloc(MAX_SAMPLES * sizeof(double));
+    if (bots == NULL || samples == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    struct epoll_event events[64];
+    double start = now_usec();
+    double end = start + seconds * 1e6;
+    double self_start = self_cpu_usec();
+    double server_start = server_pid ? proc_cpu_usec(server_pid) : -1;
+    double all_connected = 0;
+
+    while (now_usec() < end) {
+        while (next_bot < total && connecting < max_connecting) {
+            connect_bot(&addr);
+        }
+        if (all_connected == 0 && next_bot == total && connecting == 0) {
+            all_connected = now_usec();
+        }
+
+        int nready = epoll_wait(epfd, events, 64, 100);
+        for (int i = 0; i < nready; i++) {
+            struct bot *b = events[i].data.ptr;
+            if (b->state == DEAD) {
+                continue;
+            }
+            enum bot_state before = b->state;
+            handle_input(b);
+            if (b->state == DEAD) {
+                if (before == CONNECTING) {
+                    connecting--;
+                }
+                disconnects++;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, b->fd, NULL);
+                close(b->fd);
+            }
+        }
+    }
+    double elapsed = (now_usec() - start) / 1e6;
+    double self_cpu = self_cpu_usec() - self_start;
+    double server_cpu = (server_start >= 0) ? proc_cpu_usec(server_pid) - server_start : -1;
+
+    qsort(samples, num_samples, sizeof(double), compare_doubles);
+    printf("bots          %d (%d connected in %.2fs)\n", total, next_bot - connecting,
+           all_connected ? (all_connected - start) / 1e6 : elapsed);
+    if (num_watchers > 0) {
+        printf("watchers      %d (%ld updates, %.0f/s)\n", num_watchers, updates,
+               updates / elapsed);
+    }
+    printf("disconnects   %d\n", disconnects);
+    printf("guesses       %ld (%.0f/s)\n", guesses, guesses / elapsed);
+    printf("bytes in      %ld (%.0f/s)\n", bytes_in, bytes_in / elapsed);
+    printf("reads         %ld (%.1f per guess)\n", reads,
+           guesses ? (double)reads / guesses : 0.0);
+    printf("latency usec  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+           percentile(0.5), percentile(0.99), percentile(0.999),
+           num_samples ? samples[num_samples - 1] : 0);
+    printf("cpu usec      %.2f per guess", guesses ? self_cpu / guesses : 0.0);
+    if (server_cpu >= 0) {
+        printf(" (server %.2f)", guesses ? server_cpu / guesses : 0.0);
+    }
+    printf("\n");
+
+    if (max_p99 > 0 && (percentile(0.99) > max_p99 || disconnects > 0)) {
+        fprintf(stderr, "FAIL: p99 %.1f usec (limit %.1f), %d disconnects\n",
+                percentile(0.99), max_p99, disconnects);
+        return 1;
+    }
+    return 0;
+}
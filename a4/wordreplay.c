@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+
+#include "benchutil.h"
+#include "record.h"
+
+#ifndef PORT
+    #define PORT 56480
+#endif
+
+/*
+ * Replays a session recorded with wordsrv -R against a running server.
+ *
+ * Every recorded connection is opened, sent the same input and closed,
+ * in the order recorded. By default the replay runs as fast as the server
+ * will go: after each event that should be answered (a new connection,
+ * or input that completes a line) it waits for the answer before going
+ * on, so the server still sees the events in their recorded order. With
+ * -r the events are sent at the times they were recorded instead.
+ *
+ * An answer can reach its client before the rest of the output from the
+ * same event reaches the others, which could then be taken for answers
+ * to later events. So once an event is answered, a probe connection that
+ * only watches sends a line and waits for its own answer. The server
+ * handles that line in a later loop iteration, after everything from the
+ * event has been written.
+ *
+ * For the same words to come up, start the server with the seed the
+ * recording was made with (-s, printed at the start), and with -t 1 so
+ * that connections are placed in the same rooms in the same order.
+ * Resume tokens are random, so a recorded resume finds no seat.
+ *
+ * Reports the time the replay took and the latency from each answered
+ * event to the first byte of its answer.
+ *
+ * Usage: wordreplay [-h host] [-p port] [-r] <recording>
+ */
+
+// How long to wait for an answer before going on without it
+#define REPLY_TIMEOUT_MS 1000
+// How long to keep reading once the last event has been sent
+#define DRAIN_MS 200
+#define READ_BUF 4096
+// The probe's answer to any line, once it is watching
+#define PROBE_REPLY "Spectators can't play."
+// epoll data of the probe connection
+#define PROBE_ID 0xffffffffu
+
+// A replayed connection, indexed by its descriptor in the recording
+struct conn {
+    int fd;             // -1 when not open
+    double sent_at;     // When an answered event was sent, or 0
+};
+
+struct conn *conns;
+int num_conns = 0;
+int epfd;
+
+// The probe connection, and the tail of what it has been sent
+int probe_fd = -1;
+char probe_text[READ_BUF + sizeof(PROBE_REPLY)];
+int probe_len = 0;
+int probe_answered = 0;
+
+// Results
+double *samples;
+long num_samples = 0;
+long max_samples = 0;
+long bytes_in = 0;
+long timeouts = 0;
+long server_closed = 0;
+
+/*
+ * Return the connection recorded as fd, growing the table if needed.
+ */
+struct conn *get_conn(int fd) {
+    if (fd < 0 || fd > (1 << 24)) {
+        fprintf(stderr, "Bad descriptor %d in the recording\n", fd);
+        exit(1);
+    }
+    if (fd >= num_conns) {
+        int n = num_conns ? num_conns : 64;
+        while (n <= fd) {
+            n *= 2;
+        }
+        conns = realloc(conns, n * sizeof(struct conn));
+        if (conns == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        for (int i = num_conns; i < n; i++) {
+            conns[i].fd = -1;
+            conns[i].sent_at = 0;
+        }
+        num_conns = n;
+    }
+    return &conns[fd];
+}
+
+void add_sample(double usec) {
+    if (num_samples == max_samples) {
+        max_samples = max_samples ? max_samples * 2 : 4096;
+        samples = realloc(samples, max_samples * sizeof(double));
+        if (samples == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    samples[num_samples++] = usec;
+}
+
+void close_conn(struct conn *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->sent_at = 0;
+}
+
+/*
+ * Read what the server has sent the probe, noting whether it has been
+ * answered. Only the end of the text is kept, in case the answer is
+ * split across reads.
+ */
+void read_probe(void) {
+    int n;
+    while ((n = read(probe_fd, probe_text + probe_len, READ_BUF)) > 0) {
+        probe_len += n;
+        probe_text[probe_len] = '\0';
+        if (strstr(probe_text, PROBE_REPLY) != NULL) {
+            probe_answered = 1;
+            probe_len = 0;
+        } else if (probe_len >= (int)sizeof(PROBE_REPLY)) {
+            int keep = sizeof(PROBE_REPLY) - 1;
+            memmove(probe_text, probe_text + probe_len - keep, keep);
+            probe_len = keep;
+        }
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        fprintf(stderr, "The server closed the probe connection\n");
+        exit(1);
+    }
+}
+
+/*
+ * Read whatever the server has sent on any connection, waiting up to
+ * timeout_ms for something to arrive.
+ */
+void pump(int timeout_ms) {
+    struct epoll_event events[64];
+    char buf[READ_BUF];
+
+    int nready = epoll_wait(epfd, events, 64, timeout_ms);
+    for (int i = 0; i < nready; i++) {
+        if (events[i].data.u32 == PROBE_ID) {
+            read_probe();
+            continue;
+        }
+        struct conn *c = &conns[events[i].data.u32];
+        if (c->fd == -1) {
+            continue;
+        }
+        int n;
+        while ((n = read(c->fd, buf, sizeof(buf))) > 0) {
+            bytes_in += n;
+            if (c->sent_at != 0) {
+                add_sample(now_usec() - c->sent_at);
+                c->sent_at = 0;
+            }
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            server_closed++;
+            close_conn(c);
+        }
+    }
+}
+
+/*
+ * Wait for the answer to the last event sent on c.
+ */
+void wait_reply(struct conn *c) {
+    double deadline = now_usec() + REPLY_TIMEOUT_MS * 1000.0;
+    while (c->fd != -1 && c->sent_at != 0) {
+        double left = deadline - now_usec();
+        if (left <= 0) {
+            timeouts++;
+            c->sent_at = 0;
+            return;
+        }
+        pump(left / 1000 + 1);
+    }
+}
+
+/*
+ * Connect to the server and watch for the answer on epoll data id.
+ * Returns the non-blocking socket.
+ */
+int connect_to(struct sockaddr_in *addr, unsigned int id) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = id;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+    return fd;
+}
+
+void open_conn(struct conn *c, int id, struct sockaddr_in *addr) {
+    // The recorded connection closed without the server noticing in time
+    if (c->fd != -1) {
+        close_conn(c);
+    }
+    c->sent_at = now_usec();
+    c->fd = connect_to(addr, id);
+}
+
+/*
+ * Send a line on the probe connection and wait for its answer, reading
+ * everything that arrives in the meantime.
+ */
+void sync_server(void) {
+    probe_answered = 0;
+    if (write(probe_fd, "?\r\n", 3) != 3) {
+        perror("write to probe");
+        exit(1);
+    }
+    double deadline = now_usec() + REPLY_TIMEOUT_MS * 1000.0;
+    while (!probe_answered) {
+        double left = deadline - now_usec();
+        if (left <= 0) {
+            timeouts++;
+            return;
+        }
+        pump(left / 1000 + 1);
+    }
+}
+
+/*
+ * Connect the probe, as a spectator so that it takes no seat, before any
+ * of the recorded connections.
+ */
+void open_probe(struct sockaddr_in *addr) {
+    char buf[READ_BUF];
+    probe_fd = connect_to(addr, PROBE_ID);
+    // The probe has no name, so the welcome is all it is sent at first
+    fcntl(probe_fd, F_SETFL, 0);
+    if (read(probe_fd, buf, sizeof(buf)) <= 0 ||
+        write(probe_fd, "/watch\r\n", 8) != 8) {
+        fprintf(stderr, "Could not set up the probe connection\n");
+        exit(1);
+    }
+    fcntl(probe_fd, F_SETFL, O_NONBLOCK);
+    sync_server();
+}
+
+/*
+ * Send the len bytes at data on c, reading from the server meanwhile if
+ * its socket buffer is full.
+ */
+void send_input(struct conn *c, const char *data, int len) {
+    while (len > 0 && c->fd != -1) {
+        int n = write(c->fd, data, len);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                pump(1);
+                continue;
+            }
+            server_closed++;
+            close_conn(c);
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * Read the whole recording in filename. Returns the bytes of events after
+ * the header, and sets *size to how many there are.
+ */
+char *load_recording(const char *filename, struct rec_header *h, long *size) {
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    if (fread(h, sizeof(*h), 1, fp) != 1 ||
+        memcmp(h->magic, REC_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != REC_VERSION) {
+        fprintf(stderr, "%s is not a wordsrv recording\n", filename);
+        exit(1);
+    }
+    long cap = 1 << 16;
+    char *events = malloc(cap);
+    *size = 0;
+    int n;
+    while (events != NULL && (n = fread(events + *size, 1, cap - *size, fp)) > 0) {
+        *size += n;
+        if (*size == cap) {
+            cap *= 2;
+            events = realloc(events, cap);
+        }
+    }
+    if (events == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    fclose(fp);
+    return events;
+}
+
+double percentile(double p) {
+    if (num_samples == 0) {
+        return 0;
+    }
+    return samples[(long)(p * (num_samples - 1))];
+}
+
+int main(int argc, char **argv) {
+    char *host = "127.0.0.1";
+    int port = PORT;
+    int realtime = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:r")) != -1) {
+        switch (opt) {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            realtime = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-h host] [-p port] [-r] <recording>\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-h host] [-p port] [-r] <recording>\n", argv[0]);
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", host);
+        exit(1);
+    }
+
+    struct rec_header h;
+    long size;
+    char *events = load_recording(argv[optind], &h, &size);
+    printf("recording     seed %u, %u shards (replay against -s %u -t 1)\n",
+           h.seed, h.shards, h.seed);
+
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    long connects = 0, inputs = 0, closes = 0;
+    if (!realtime) {
+        open_probe(&addr);
+    }
+    double start = now_usec();
+    long pos = 0;
+    while (pos + (long)sizeof(struct rec_event) <= size) {
+        struct rec_event e;
+        memcpy(&e, events + pos, sizeof(e));
+        pos += sizeof(e);
+        const char *data = events + pos;
+        pos += e.len;
+        if (pos > size) {
+            fprintf(stderr, "The recording ends part way through an event\n");
+            break;
+        }
+
+        if (realtime) {
+            double due = start + e.usec;
+            double now;
+            while ((now = now_usec()) < due) {
+                pump((due - now) / 1000 + 1);
+            }
+        } else {
+            // Keep up with the answers so the server's queues stay short
+            pump(0);
+        }
+
+        struct conn *c = get_conn(e.fd);
+        switch (e.type) {
+        case REC_CONNECT:
+            open_conn(c, e.fd, &addr);
+            connects++;
+            break;
+        case REC_INPUT:
+            if (c->fd == -1) {
+                continue;
+            }
+            // Only a complete line is answered
+            if (memchr(data, '\n', e.len) != NULL) {
+                c->sent_at = now_usec();
+            }
+            send_input(c, data, e.len);
+            inputs++;
+            break;
+        case REC_CLOSE:
+            if (c->fd != -1) {
+                close_conn(c);
+            }
+            closes++;
+            break;
+        default:
+            fprintf(stderr, "Unknown event type %d\n", e.type);
+            exit(1);
+        }
+        if (!realtime && (e.type == REC_CLOSE || c->sent_at != 0)) {
+            wait_reply(c);
+            sync_server();
+        }
+    }
+    double elapsed = (now_usec() - start) / 1e6;
+
+    double drain_end = now_usec() + DRAIN_MS * 1000.0;
+    while (now_usec() < drain_end) {
+        pump(DRAIN_MS);
+    }
+
+    qsort(samples, num_samples, sizeof(double), compare_doubles);
+    printf("events        %ld connects, %ld inputs, %ld closes in %.2fs (%.0f/s)\n",
+           connects, inputs, closes, elapsed, (connects + inputs + closes) / elapsed);
+    printf("answers       %ld (%ld timed out, %ld closed by server)\n", num_samples,
+           timeouts, server_closed);
+    printf("bytes in      %ld\n", bytes_in);
+    printf("latency usec  p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+           percentile(0.5), percentile(0.99), percentile(0.999),
+           num_samples ? samples[num_samples - 1] : 0);
+    return 0;
+}
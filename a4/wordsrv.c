@@ -9,62 +9,517 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <signal.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <poll.h>
+#include <sys/random.h>
+#include <sys/signalfd.h>
 
 #include "socket.h"
 #include "gameplay.h"
+#include "loop.h"
+#include "log.h"
+#include "record.h"
+#include "supervisor.h"
+#include "binproto.h"
 
 
 #ifndef PORT
     #define PORT 56480
 #endif
-#define MAX_QUEUE 5
-
-
-void add_player(struct client **top, int fd, struct in_addr addr);
-void remove_player(struct client **top, int fd);
+// Default length of the queue of connections waiting to be accepted;
+// the kernel caps it at net.core.somaxconn
+#define DEFAULT_BACKLOG 4096
+// Most connections passed to a shard in one write
+#define HANDOFF_BATCH 64
+// Seconds between reports of the accept counters
+#define ACCEPT_REPORT_SECS 10
+// Default number of bytes that may be queued for a client before the
+// server gives up on it
+#define DEFAULT_HIGH_WATER (64 * 1024)
+// Default number of clients placed in one room
+#define DEFAULT_ROOM_SIZE 8
+// Default number of seconds allowed for a guess, for entering a name, and
+// between any two reads from a player
+#define DEFAULT_TURN_TIMEOUT 60
+#define DEFAULT_NAME_TIMEOUT 30
+#define DEFAULT_IDLE_TIMEOUT 600
+// Default number of seconds a dropped player's seat is held for a resume
+#define DEFAULT_GRACE 30
+// A client resumes a held seat by sending this and its token as its name
+#define RESUME_CMD "/resume "
+// Sent instead of a name to watch a game rather than play
+#define WATCH_CMD "/watch"
+// Most updates a second sent to spectators, unless set with -S
+#define DEFAULT_WATCH_RATE 4
+// Most spectators sent an update in one go, so that a crowd of them
+// never holds up the players for long
+#define WATCH_BATCH 256
+// The top bits of a resume token name the shard holding the seat
+#define TOKEN_SHARD_SHIFT 56
+// Version of the state handed from one process to the next; change it
+// whenever a structure carried in a struct upgrade_rec changes
+#define UPGRADE_VERSION 8
+// Bytes of queued output carried by one upgrade record
+#define UPGRADE_CHUNK 4096
+// Seconds to wait for a new process to confirm it has taken over
+#define UPGRADE_TIMEOUT 10
+// Requests a shard's io_uring can hold before they must be submitted
+#define URING_ENTRIES 4096
+// Input buffers of each shard's io_uring. A burst of input from more
+// connections than this ends some of their reads early, and they are
+// started again.
+#define URING_BUFS 4096
+
+// The room that contains game
+#define room_of(game) \
+    ((struct room *)((char *)(game) - offsetof(struct room, game)))
+
+
+void add_player(struct client **top, int fd, struct in_addr addr,
+                struct room *room);
+void remove_player(struct client **top, struct client *p);
+void join_game(struct client *p, struct game_state *game, char *name);
+void broadcast_pair(struct game_state *game, struct msg *text, struct msg *bin,
+                    struct client *skip);
 void advance_turn(struct game_state *game);
-void write_msg(char *msg, struct client *p, struct game_state *game);
+void write_msg(char *msg, struct client *p);
+void send_msg(struct msg *m, struct client *p);
+void disconnect_player(struct client *p, struct game_state *game);
+void flush_client(struct client *p);
+void mark_closing(struct client *p);
 void announce_turn(struct game_state *game);
+void print_stats(struct shard *s);
+struct dictionary *current_dictionary(void);
+void arm_idle_timer(struct client *p);
+void idle_expired(struct timer *t);
+void unhold_player(struct client *p);
+void issue_token(struct client *p);
+void watch_expired(struct timer *t);
+int watch_client(struct client *p);
+void unwatch_client(struct client *p);
+void close_client(struct client *p);
+void start_send(struct client *p);
+void end_iteration(struct shard *s);
+void give_up_connection(struct client *p);
+void send_handoff(int target, struct handoff *h);
+
+// Maximum number of bytes queued for one client, set with -w
+int high_water = DEFAULT_HIGH_WATER;
+
+// Maximum number of clients placed in one room, set with -r
+int room_size = DEFAULT_ROOM_SIZE;
+
+// Length of the listen queue, set with -b
+int backlog = DEFAULT_BACKLOG;
+
+// Timeouts in seconds, set with -T, -N and -I; 0 turns one off
+int turn_timeout = DEFAULT_TURN_TIMEOUT;
+int name_timeout = DEFAULT_NAME_TIMEOUT;
+int idle_timeout = DEFAULT_IDLE_TIMEOUT;
+
+// Seconds a dropped player's seat is held, set with -G; 0 turns it off
+int grace_period = DEFAULT_GRACE;
+
+// Most updates a second sent to spectators, set with -S
+int watch_rate = DEFAULT_WATCH_RATE;
+
+// The dictionary new games take their words from, shared read-only by
+// every shard. SIGHUP loads the file again and swaps the pointer.
+struct dictionary *dictionary;
+char *dictionary_path;
+
+// The worker threads, set with -t. Each one owns its rooms outright.
+struct shard *shards;
+int num_shards;
+
+// Seed of the word generators of the rooms, set with -s
+unsigned int seed;
+
+// 1 if network I/O goes through io_uring rather than epoll, set with -B
+int use_uring = 0;
+
+// The shard whose thread this is, or NULL
+__thread struct shard *this_shard;
+
+// Where a newer process can connect to take over, set with -u
+char *upgrade_path = NULL;
+
+// Where clients on this host can connect without TCP, set with -L
+char *local_path = NULL;
+
+// Where local tools can ask for the server's metrics, set with -A
+char *admin_path = NULL;
+
+// When the server started, in microseconds
+unsigned long started;
+
+// Accept counters at the start of a reporting period
+struct accept_report {
+    long start;         // When the period started, in ms
+    long accepted;
+    long aborted;
+    long shed;
+    int listenfd;       // The listening socket reported on
+    long drops;         // Connections it has dropped, or -1
+    int max_depth;      // Longest listen queue seen in the period
+};
+
+/* One message of the state handed to a new process: the listening
+ * socket and the local one if there is one, then each room followed by
+ * its clients, each client followed by the output still queued for it,
+ * and finally the totals.
+ */
+enum upgrade_type {
+    UPGRADE_HELLO,      // Carries the listening socket
+    UPGRADE_LOCAL,      // Carries the local listening socket
+    UPGRADE_ROOM,
+    UPGRADE_CLIENT,     // Carries the client's socket
+    UPGRADE_OUTPUT,
+    UPGRADE_END
+};
+
+struct upgrade_rec {
+    int type;
+    union {
+        struct {
+            int version;
+            int size;           // sizeof(struct upgrade_rec), to catch
+                                // builds that do not agree on the layout
+        } hello;
+        struct {
+            char word[MAX_WORD];
+            unsigned int guessed;
+            int guesses_left;
+            int shard;          // The shard it was in, if it has held seats
+                                // whose tokens name that shard; else -1
+        } room;
+        struct {
+            struct in_addr addr;
+            char name[MAX_NAME];    // Empty for a client in new_players
+            struct line_buf in;     // Where the stream is, and in_data
+            char in_data[LINEBUF_SIZE]; // what its buffer holds, including
+                                        // any partial line
+            unsigned long long token;
+            int has_turn;
+            int spectator;
+            int binary;
+            int held;           // 1 for a held seat, which has no fd
+        } client;
+        struct {
+            int len;
+            char data[UPGRADE_CHUNK];
+        } output;
+        struct {
+            int rooms;
+            int clients;
+        } end;
+    } u;
+};
+
+// Bytes of a record whose union holds member
+#define UPGRADE_SIZE(member) \
+    (offsetof(struct upgrade_rec, u) + sizeof(((struct upgrade_rec *)0)->u.member))
+
+
+/* Returns 1 if any player in game other than skip (which may be NULL)
+ * speaks the binary protocol, when binary is 1, or the text one, when it
+ * is 0. Messages nobody would receive are then never built.
+ */
+int has_players(struct game_state *game, int binary, struct client *skip) {
+    for (struct client *p = game->head; p != NULL; p = p->next) {
+        if (p != skip && p->binary == binary) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Send the already built message text to the text clients and the frame
+ * bin to the binary clients, except skip (which may be NULL). Either may
+ * be NULL to send nothing to clients of that kind.
+ */
+void broadcast_pair(struct game_state *game, struct msg *text, struct msg *bin,
+                    struct client *skip) {
+    for (struct client *p = game->head; p != NULL; p = p->next) {
+        struct msg *m = p->binary ? bin : text;
+        if (p != skip && m != NULL) {
+            send_msg(m, p);
+        }
+    }
+}
+
+/* Send the message in outbuf to the text clients except skip (which may
+ * be NULL). Binary clients learn the same from a frame of their own.
+ */
+void broadcast_text(struct game_state *game, char *outbuf, struct client *skip) {
+    if (has_players(game, 0, skip)) {
+        struct msg *m = msg_new(outbuf, strlen(outbuf));
+        broadcast_pair(game, m, NULL, skip);
+        msg_unref(m);
+    }
+}
+
+/* Send the message in outbuf to all clients except skip (which may be NULL).
+ * The message is built once and shared by every client's queue, and
+ * binary clients share it in a BIN_TEXT frame.
+ */
+void broadcast_except(struct game_state *game, char *outbuf, struct client *skip) {
+    int len = strlen(outbuf);
+    struct msg *text = has_players(game, 0, skip) ? msg_new(outbuf, len) : NULL;
+    struct msg *bin = has_players(game, 1, skip) ? bin_frame(BIN_TEXT, outbuf, len) : NULL;
+    broadcast_pair(game, text, bin, skip);
+    if (text != NULL) {
+        msg_unref(text);
+    }
+    if (bin != NULL) {
+        msg_unref(bin);
+    }
+}
 
 /* Send the message in outbuf to all clients */
 void broadcast(struct game_state *game, char *outbuf) {
-    for (struct client *p = game->head; p != NULL; p = p->next) {
-        write_msg(outbuf, p, game); 
+    broadcast_except(game, outbuf, NULL);
+}
+
+/*
+ * Writes msg to client p alone, in a BIN_TEXT frame if p speaks the
+ * binary protocol.
+*/
+void write_msg(char *msg, struct client *p) {
+    int len = strlen(msg);
+    struct msg *m = p->binary ? bin_frame(BIN_TEXT, msg, len) : msg_new(msg, len);
+    send_msg(m, p);
+    msg_unref(m);
+}
+
+/*
+ * Sends every player the status of game, each in their own protocol.
+ */
+void broadcast_status(struct game_state *game) {
+    broadcast_pair(game, has_players(game, 0, NULL) ? status_message(game) : NULL,
+                   has_players(game, 1, NULL) ? bin_status_message(game) : NULL, NULL);
+}
+
+/*
+ * Sends client p the status of its game.
+ */
+void send_status(struct client *p) {
+    struct game_state *game = &p->room->game;
+    send_msg(p->binary ? bin_status_message(game) : status_message(game), p);
+}
+
+/*
+ * Tells client p whose turn it is in game, prompting them for a guess if
+ * it is theirs.
+ */
+void tell_turn(struct client *p, struct game_state *game) {
+    struct client *turn = game->has_next_turn;
+    char msg[MAX_MSG];
+
+    if (p->binary) {
+        struct msg *m = bin_turn_message(turn->name, turn == p);
+        send_msg(m, p);
+        msg_unref(m);
+    } else if (turn == p) {
+        write_msg("Your guess?\r\n", p);
+    } else {
+        sprintf(msg, "It's %s's turn.\r\n", turn->name);
+        write_msg(msg, p);
+    }
+}
+
+/*
+ * Tells every player that the player whose turn it is has guessed letter:
+ * text clients get a line saying so and the new status, binary clients
+ * just the letter and where it is in the word.
+ */
+void broadcast_guess(struct game_state *game, char letter) {
+    char msg[MAX_MSG];
+
+    if (has_players(game, 0, NULL)) {
+        sprintf(msg, "%s guesses %c.\r\n", game->has_next_turn->name, letter);
+        broadcast_text(game, msg, NULL);
+        broadcast_pair(game, status_message(game), NULL, NULL);
+    }
+    if (has_players(game, 1, NULL)) {
+        struct msg *m = bin_guessed_message(game, letter);
+        broadcast_pair(game, NULL, m, NULL);
+        msg_unref(m);
+    }
+}
+
+/*
+ * Tells the binary clients that game is over: won by winner, or lost if
+ * winner is NULL. Text clients are told by the caller.
+ */
+void broadcast_over(struct game_state *game, struct client *winner) {
+    if (!has_players(game, 1, NULL)) {
+        return;
+    }
+    struct msg *m = bin_over_message(game, winner ? BIN_OTHER_WON : BIN_LOST,
+                                     winner ? winner->name : NULL);
+    broadcast_pair(game, NULL, m, winner);
+    msg_unref(m);
+    if (winner != NULL && winner->binary) {
+        m = bin_over_message(game, BIN_WON, NULL);
+        send_msg(m, winner);
+        msg_unref(m);
+    }
+}
+
+/*
+ * Puts client p on its shard's list of clients whose output is written
+ * at the end of the loop iteration.
+ */
+void cork_client(struct client *p) {
+    if (!p->corked) {
+        struct shard *s = p->room->shard;
+        p->corked = 1;
+        p->corked_next = s->corked;
+        s->corked = p;
     }
 }
 
 /*
- * Writes msg to client p. Handles client disconnect. Assumes that
- * the client is in the list of active players.
+ * Queues m for client p, to be written along with everything else queued
+ * for p by flush_corked at the end of the loop iteration. A client that
+ * falls more than high_water bytes behind is marked for disconnection.
 */
-void write_msg(char *msg, struct client *p, struct game_state *game) {
-    int num_written = write(p->fd, msg, strlen(msg));
-    if (num_written == -1 || num_written != strlen(msg)) {
-        char out[MAX_MSG];
+void send_msg(struct msg *m, struct client *p) {
+    // Client is already being disconnected
+    if (p->fd == -1 || p->closing) {
+        return;
+    }
 
-        // Notify server of disconnect.
-        printf("Disconnected from %s\n", inet_ntoa(p->ipaddr));
+    outq_push(&p->outq, m);
+    if (p->outq.bytes > high_water) {
+        log_msg(LOG_INFO, "[%d] %d bytes queued, over the limit; disconnecting\n",
+                p->fd, p->outq.bytes);
+        mark_closing(p);
+        return;
+    }
+    // While the socket is full, the event loop flushes p once it drains
+    if (!p->want_write) {
+        cork_client(p);
+    }
+}
 
-        // Advance turn if we are removing player whose turn it is
-        if (game->has_next_turn == p) {
-            advance_turn(game);
+/*
+ * Writes out the output queued for clients of shard s during this loop
+ * iteration, so that each client gets one writev for all of it rather
+ * than one write per message.
+ */
+void flush_corked(struct shard *s) {
+    while (s->corked != NULL) {
+        // Flushing a spectator may queue more for it, so take the list
+        struct client *p = s->corked;
+        s->corked = NULL;
+        while (p != NULL) {
+            struct client *next = p->corked_next;
+            p->corked = 0;
+            if (p->fd != -1 && !p->closing) {
+                flush_client(p);
+            }
+            p = next;
         }
+    }
+}
+
+/*
+ * Called when everything queued for client p has been written after the
+ * socket was full. A spectator that fell behind skipped the updates sent
+ * since; now that it has caught up, send only the latest.
+ */
+void caught_up(struct client *p) {
+    struct room *room = p->room;
+    if (p->spectator && room->watch_msg != NULL &&
+        p->seen_version != room->watch_version) {
+        p->seen_version = room->watch_version;
+        send_msg(room->watch_msg, p);
+    }
+}
 
-        // Remove the player
-        remove_player(&game->head, p->fd);
+/*
+ * Writes queued output to client p. Asks the event loop to report when
+ * the socket is writable while output remains, and stops asking once
+ * the queue is empty.
+ *
+ * With io_uring, starts a send of the queued output unless one is in
+ * flight; a client has one at a time, so its output stays in order, and
+ * whatever is queued meanwhile goes out in the next.
+ */
+void flush_client(struct client *p) {
+    if (use_uring) {
+        struct shard *s = p->room->shard;
+        if (s != this_shard) {
+            // Only the shard's own thread submits requests to its ring;
+            // it flushes its corked clients when it starts
+            cork_client(p);
+        } else if (!p->want_write && p->outq.bytes > 0 && !s->frozen) {
+            start_send(p);
+        }
+        return;
+    }
 
-        // Make sure game is playable for any clients in new_players
-        if (game->head == NULL) {
-            game->has_next_turn = NULL;
+    int left = outq_flush(&p->outq, p->fd);
+    if (left >= 0) {
+        hist_record(&p->room->shard->stats.outq_bytes, left);
+    }
+    if (left < 0) {
+        mark_closing(p);
+    } else if (left > 0 && !p->want_write) {
+        // A client the loop cannot wake for would never get its output
+        if (loop_mod(p->room->shard->epfd, p->fd, p, EPOLLIN | EPOLLOUT) < 0) {
+            mark_closing(p);
+            return;
+        }
+        p->want_write = 1;
+    } else if (left == 0 && p->want_write) {
+        if (loop_mod(p->room->shard->epfd, p->fd, p, EPOLLIN) < 0) {
+            mark_closing(p);
+            return;
         }
+        p->want_write = 0;
+        caught_up(p);
+    }
+}
+
+/*
+ * Removes active player p from the game, passing the turn on if it was
+ * theirs, and says goodbye to the remaining players.
+ */
+void disconnect_player(struct client *p, struct game_state *game) {
+    char out[MAX_MSG];
+
+    // Notify server of disconnect.
+    log_msg(LOG_INFO, "Disconnected from %s\n", peer_name(p->ipaddr));
+
+    // Advance turn if we are removing player whose turn it is
+    if (game->has_next_turn == p) {
+        advance_turn(game);
+    }
+    if (room_of(game)->turn_owner == p) {
+        room_of(game)->turn_owner = NULL;
+    }
+
+    // Remove the player. p is not freed until the end of this loop
+    // iteration, so its name is still valid below.
+    remove_player(&game->head, p);
 
-        // Broadcast goodbye message to any active clients
-        sprintf(out, "Goodbye %s.\r\n", p->name);
-        broadcast(game, out);
-        announce_turn(game);
+    // Make sure game is playable for any clients in new_players
+    if (game->head == NULL) {
+        game->has_next_turn = NULL;
     }
+
+    // Broadcast goodbye message to any active clients
+    sprintf(out, "Goodbye %s.\r\n", p->name);
+    broadcast(game, out);
+    announce_turn(game);
 }
 
 /* Move the has_next_turn pointer to the next active client */
@@ -76,36 +531,55 @@ void advance_turn(struct game_state *game) {
     } 
 }
 
+/*
+ * Starts the clock on a guess when the turn in room has passed to someone
+ * new.
+ */
+void start_turn_clock(struct room *room) {
+    if (room->turn_owner != room->game.has_next_turn) {
+        room->turn_owner = room->game.has_next_turn;
+        if (turn_timeout > 0) {
+            timer_add(&room->shard->timers, &room->turn_timer,
+                      turn_timeout * 1000UL);
+        }
+    }
+}
+
 /*
  * Announces which players turn it is to all active clients 
  * except that player, to which it prompts for a guess.
 */
 void announce_turn(struct game_state *game) {
-    struct client *p;
     char msg[MAX_MSG];
+    struct room *room = room_of(game);
 
-    for (p = game->head; p; p = p->next) {
-        if (p != game->has_next_turn) {
-            sprintf(msg, "It's %s's turn.\r\n", game->has_next_turn->name);
-        } else {
-            sprintf(msg, "Your guess?\r\n");
-            printf("Its %s's turn.\n", game->has_next_turn->name);
-        }
-        write_msg(msg, p, game);
+    if (game->has_next_turn == NULL) {
+        timer_cancel(&room->shard->timers, &room->turn_timer);
+        room->turn_owner = NULL;
+        return;
     }
-}
 
-/*
- * Looks for a network newline in buf. Returns the index of the \n in buf if 
- * such a newline exists, and -1 otherwise.
-*/
-int find_network_newline(char *buf, int size) {
-    for (int i = 0; i < size; i++) {
-        if (i > 0 && buf[i] == '\n' && buf[i-1] == '\r') {
-            return i;
-        }
+    start_turn_clock(room);
+
+    struct client *turn = game->has_next_turn;
+    struct msg *text = NULL, *bin = NULL;
+    if (has_players(game, 0, turn)) {
+        sprintf(msg, "It's %s's turn.\r\n", turn->name);
+        text = msg_new(msg, strlen(msg));
     }
-    return -1;
+    if (has_players(game, 1, turn)) {
+        bin = bin_turn_message(turn->name, 0);
+    }
+    broadcast_pair(game, text, bin, turn);
+    if (text != NULL) {
+        msg_unref(text);
+    }
+    if (bin != NULL) {
+        msg_unref(bin);
+    }
+
+    tell_turn(turn, game);
+    log_msg(LOG_DEBUG, "Its %s's turn.\n", turn->name);
 }
 
 /*
@@ -113,23 +587,12 @@ int find_network_newline(char *buf, int size) {
  * an empty string. Returns 0 otherwise.
 */
 int check_name(char *name, struct game_state *game) {
-    for (struct client *curr = game->head; curr != NULL; curr = curr->next) {
-        if (strcmp(curr->name, name) == 0 || strlen(name) > MAX_NAME || strlen(name) == 0) {
-            return -1;
-        }
+    int len = strlen(name);
+    if (len >= MAX_NAME || len == 0) {
+        return -1;
     }
-    return 0;
-}
-
-/*
- * Checks if a guess is valid. Returns 1 if the guess is not a single character between a and z,
- * returns 2 if the guess has already been made, and returns 0 otherwise.
-*/
-int check_guess(char *guess, struct game_state *game) {
-    if (strlen(guess) > 1 || guess[0] < 'a' || guess[0] > 'z' || strlen(guess) == 0) {
-        return 1;
-    } else if (game->letters_guessed[guess[0] - 'a']) {
-        return 2;
+    if (nameset_contains(&game->names, name)) {
+        return -1;
     }
     return 0;
 }
@@ -141,98 +604,161 @@ int check_guess(char *guess, struct game_state *game) {
 */
 int make_guess(struct game_state *game, char guess) {
     char msg[MAX_MSG];
-    int correct = 0;
+    int correct = apply_guess(game, guess);
 
-    // Loop through word and update guess accordingly
-    // Sets correct to be 1 if a matching letter is found
-    for (int i = 0; i < strlen(game->word); i++) {
-        if (game->word[i] == guess) {
-            game->guess[i] = guess;
-            correct = 1;
-        }
-    }
-    
-    // Guess is incorrect, notify client, print to server, update number of guesses
+    // Guess is incorrect, notify client, print to server. A binary
+    // client sees it from the positions in the frame for the guess.
     if (!correct) {
-        sprintf(msg, "%c is not in the word.\r\n", guess);
-        write_msg(msg, game->has_next_turn, game);
-        printf("Letter %c is not in the word\n", guess);
-        game->guesses_left -= 1;
-    }
-
-    // Update letters guessed
-    game->letters_guessed[guess - 'a'] = 1;
-    return correct;
-}
-
-/*
- * Checks game_state game to see if the game is over. Returns 
- * 2 if the number of guesses is 0, returns 1 if the game has
- * been won, and returns 0 if the game is still active.
-*/
-int check_game_over(struct game_state *game) {
-    if (game->guesses_left == 0) {
-        return 2;
-    }
-
-    for (int i = 0; i < strlen(game->guess); i++) {
-        if (game->guess[i] == '-') {
-            return 0;
+        if (!game->has_next_turn->binary) {
+            sprintf(msg, "%c is not in the word.\r\n", guess);
+            write_msg(msg, game->has_next_turn);
         }
+        log_msg(LOG_DEBUG, "Letter %c is not in the word\n", guess);
     }
-
-    return 1;
+    return correct;
 }
 
-/* The set of socket descriptors for select to monitor.
- * This is a global variable because we need to remove socket descriptors
- * from allset when a write to a socket fails.
- */
-fd_set allset;
-
-
 /* 
- * Add a client to the head of the linked list
+ * Add a client in room to the head of the linked list. Its socket fd
+ * must already be non-blocking, so writes never block the event loop.
+ * A held seat taken over from an old process has no connection, and fd
+ * is then -1.
  */
-void add_player(struct client **top, int fd, struct in_addr addr) {
-    struct client *p = malloc(sizeof(struct client));
-
-    if (!p) {
-        perror("malloc");
-        exit(1);
-    }
+void add_player(struct client **top, int fd, struct in_addr addr,
+                struct room *room) {
+    struct client *p = pool_get(&room->shard->clients);
 
-    printf("Adding client %s\n", inet_ntoa(addr));
+    log_msg(LOG_DEBUG, "Adding client %s\n", peer_name(addr));
 
     p->fd = fd;
     p->ipaddr = addr;
     p->name[0] = '\0';
-    p->in_ptr = p->inbuf;
-    p->inbuf[0] = '\0';
+    linebuf_init(&p->in);
     p->next = *top;
+    p->reap_next = NULL;
+    p->closing = 0;
+    p->want_write = 0;
+    p->room = room;
+    p->token = 0;
+    p->held = 0;
+    p->held_next = NULL;
+    p->binary = 0;
+    p->spectator = 0;
+    p->seen_version = 0;
+    p->corked = 0;
+    p->corked_next = NULL;
+    p->recv = NULL;
+    p->send = NULL;
+    outq_init(&p->outq);
+    timer_init(&p->idle, idle_expired);
+    arm_idle_timer(p);
     *top = p;
+    room->num_clients++;
+
+    if (fd != -1) {
+        watch_client(p);
+    }
 }
 
 /* Removes client from the linked list and closes its socket.
- * Also removes socket descriptor from allset 
+ * The client itself is moved to the graveyard and freed by free_removed.
  */
-void remove_player(struct client **top, int fd) {
+void remove_player(struct client **top, struct client *client) {
     struct client **p;
 
-    for (p = top; *p && (*p)->fd != fd; p = &(*p)->next)
+    // Search by client, since a held player has no descriptor
+    for (p = top; *p && *p != client; p = &(*p)->next)
         ;
     // Now, p points to (1) top, or (2) a pointer to another client
     // This avoids a special case for removing the head of the list
     if (*p) {
         struct client *t = (*p)->next;
-        printf("Removing client %d %s\n", fd, inet_ntoa((*p)->ipaddr));
-        FD_CLR((*p)->fd, &allset);
-        close((*p)->fd);
-        free(*p);
+        struct room *room = (*p)->room;
+        log_msg(LOG_DEBUG, "Removing client %d %s\n", client->fd,
+                peer_name(client->ipaddr));
+        if (client->held) {
+            unhold_player(client);
+        } else {
+            if (recording) {
+                record_event(REC_CLOSE, client->fd, NULL, 0);
+            }
+            close_client(client);
+        }
+        (*p)->fd = -1;
+        outq_clear(&(*p)->outq);
+        timer_cancel(&room->shard->timers, &(*p)->idle);
+        // Only players have a name; clients in new_players are not in the set
+        if ((*p)->name[0] != '\0') {
+            nameset_remove(&room->game.names, *p);
+            room->num_players--;
+        }
+        if (client->spectator) {
+            // Don't leave an update round pointing at a freed client
+            if (room->watch_cursor == client) {
+                room->watch_cursor = t;
+            }
+        } else {
+            room->num_clients--;
+        }
+        __atomic_fetch_sub(&room->shard->load, 1, __ATOMIC_RELAXED);
+        // Leave (*p)->next alone so a broadcast walking the list can step
+        // past a client that was removed underneath it.
+        (*p)->reap_next = room->shard->graveyard;
+        room->shard->graveyard = *p;
         *p = t;
     } else {
-        fprintf(stderr, "Trying to remove fd %d, but I don't know about it\n",
-                 fd);
+        log_msg(LOG_ERROR, "Trying to remove fd %d, but I don't know about it\n",
+                client->fd);
+    }
+}
+
+/*
+ * Marks client p to be disconnected by reap_closing.
+ */
+void mark_closing(struct client *p) {
+    if (!p->closing) {
+        struct shard *s = p->room->shard;
+        p->closing = 1;
+        p->reap_next = s->closing;
+        s->closing = p;
+    }
+}
+
+/*
+ * Disconnects every client marked by mark_closing. Saying goodbye to the
+ * remaining players may mark more clients, so keep going until none are
+ * left.
+ */
+void reap_closing(struct shard *s) {
+    while (s->closing != NULL) {
+        struct client *p = s->closing;
+        s->closing = p->reap_next;
+
+        // Clients without a name are still in new_players
+        if (p->spectator) {
+            log_msg(LOG_INFO, "Spectator %s left\n", peer_name(p->ipaddr));
+            remove_player(&p->room->spectators, p);
+        } else if (p->name[0] != '\0') {
+            disconnect_player(p, &p->room->game);
+        } else {
+            log_msg(LOG_INFO, "Disconnected from %s\n", peer_name(p->ipaddr));
+            remove_player(&p->room->new_players, p);
+        }
+    }
+}
+
+/*
+ * Frees every client removed during the current loop iteration. They are
+ * only freed once every ready event has been handled, because a later
+ * event in the same batch (or a broadcast in progress) may still refer
+ * to them.
+ */
+void free_removed(struct shard *s) {
+    while (s->graveyard != NULL) {
+        struct client *next = s->graveyard->reap_next;
+        linebuf_clear(&s->graveyard->in, &s->inbufs);
+        pool_put(&s->clients, s->graveyard);
+        s->graveyard = next;
     }
 }
 
@@ -240,10 +766,10 @@ void remove_player(struct client **top, int fd) {
  * Removes and returns client from the linked list without closing the socket.
  * Used as an intermediate step when changing the linked lists.
  */
-void temp_remove_player(struct client **top, int fd) {
+void temp_remove_player(struct client **top, struct client *client) {
     struct client **p;
 
-    for (p = top; *p && (*p)->fd != fd; p = &(*p)->next)
+    for (p = top; *p && *p != client; p = &(*p)->next)
         ;
     // Now, p points to (1) top, or (2) a pointer to another client
     // This avoids a special case for removing the head of the list
@@ -251,328 +777,2407 @@ void temp_remove_player(struct client **top, int fd) {
         struct client *t = (*p)->next;
         *p = t;
     } else {
-        fprintf(stderr, "Trying to change the list of fd %d, but I don't know about it\n",
-                 fd);
+        log_msg(LOG_ERROR, "Trying to change the list of fd %d, but I don't know about it\n",
+                client->fd);
     }
 }
 
+/*
+ * Schedules an update for the spectators of room if the game has changed
+ * since the last one. Updates go out at most watch_rate times a second,
+ * so any changes in between are coalesced into a single update.
+ */
+void notify_spectators(struct room *room) {
+    if (room->spectators == NULL || room->watch_cursor != NULL ||
+        room->game.version == room->watch_version ||
+        timer_pending(&room->watch_timer)) {
+        return;
+    }
+    long wait = (long)(room->watch_sent + 1000 / watch_rate - timer_now_ms());
+    timer_add(&room->shard->timers, &room->watch_timer, wait > 0 ? wait : 0);
+}
 
-int main(int argc, char **argv) {
-    // Handler for SIGPIPE
-    struct sigaction sa;
-    sa.sa_handler = SIG_IGN;
-    sa.sa_flags = 0;
-    sigemptyset(&sa.sa_mask);
-    if(sigaction(SIGPIPE, &sa, NULL) == -1) {
-        perror("sigaction");
-        exit(1);
+/*
+ * Sends the latest state of the game to the spectators of a room, a batch
+ * at a time. Spectators still behind on an earlier update are skipped,
+ * and flush_client sends them the latest once they catch up.
+ */
+void watch_expired(struct timer *t) {
+    struct room *room = (struct room *)((char *)t - offsetof(struct room, watch_timer));
+
+    // Start a new round of updates, unless one is still going out
+    if (room->watch_cursor == NULL) {
+        if (room->watch_msg != NULL) {
+            msg_unref(room->watch_msg);
+        }
+        room->watch_msg = watch_message(&room->game);
+        room->watch_version = room->game.version;
+        room->watch_sent = timer_now_ms();
+        room->watch_cursor = room->spectators;
     }
 
-    int clientfd, maxfd, nready;
-    struct client *p;
-    struct sockaddr_in q;
-    fd_set rset;
-    
-    if(argc != 2){
-        fprintf(stderr,"Usage: %s <dictionary filename>\n", argv[0]);
-        exit(1);
+    for (int i = 0; i < WATCH_BATCH && room->watch_cursor != NULL; i++) {
+        struct client *p = room->watch_cursor;
+        room->watch_cursor = p->next;
+        if (p->outq.bytes == 0 && p->seen_version != room->watch_version) {
+            p->seen_version = room->watch_version;
+            send_msg(room->watch_msg, p);
+        }
     }
-    
-    // Create and initialize the game state
-    struct game_state game;
-
-    srandom((unsigned int)time(NULL));
-    // Set up the file pointer outside of init_game because we want to 
-    // just rewind the file when we need to pick a new word
-    game.dict.fp = NULL;
-    game.dict.size = get_file_length(argv[1]);
-
-    init_game(&game, argv[1]);
-    
-    // head and has_next_turn also don't change when a subsequent game is
-    // started so we initialize them here.
-    game.head = NULL;
-    game.has_next_turn = NULL;
-    
-    /* A list of client who have not yet entered their name.  This list is
-     * kept separate from the list of active players in the game, because
-     * until the new playrs have entered a name, they should not have a turn
-     * or receive broadcast messages.  In other words, they can't play until
-     * they have a name.
-     */
-    struct client *new_players = NULL;
-    
-    struct sockaddr_in *server = init_server_addr(PORT);
-    int listenfd = set_up_server_socket(server, MAX_QUEUE);
-    
-    // initialize allset and add listenfd to the
-    // set of file descriptors passed into select
-    FD_ZERO(&allset);
-    FD_SET(listenfd, &allset);
-    // maxfd identifies how far into the set to search
-    maxfd = listenfd;
 
-    while (1) {
-        // make a copy of the set before we pass it into select
-        rset = allset;
-        nready = select(maxfd + 1, &rset, NULL, NULL, NULL);
-        if (nready == -1) {
-            perror("select");
-            continue;
+    // Carry on with the rest on the next tick, giving the players a turn
+    // in between
+    if (room->watch_cursor != NULL) {
+        timer_add(&room->shard->timers, &room->watch_timer, 0);
+    } else {
+        notify_spectators(room);
+    }
+}
+
+/*
+ * Returns the room of shard s with id room_id, or if name is not NULL the
+ * room where someone called name is playing, or NULL if there is none.
+ */
+struct room *find_room(struct shard *s, int room_id, const char *name) {
+    for (struct room *room = s->rooms; room != NULL; room = room->next) {
+        if (name != NULL ? nameset_contains(&room->game.names, name)
+                         : room->id == room_id) {
+            return room;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Tells spectator p, newly in target's spectators, what they are watching
+ * and sends them the state of the game.
+ */
+void greet_spectator(struct client *p, struct room *target) {
+    char msg[MAX_MSG];
+
+    log_msg(LOG_INFO, "%s is watching room %d.%d\n", peer_name(p->ipaddr),
+            target->shard->id, target->id);
+    sprintf(msg, "You are watching room %d.%d.\r\n", target->shard->id, target->id);
+    write_msg(msg, p);
+    struct msg *m = watch_message(&target->game);
+    p->seen_version = target->game.version;
+    send_msg(m, p);
+    msg_unref(m);
+}
+
+/*
+ * Makes client p in new_players a spectator of a game, and sends them the
+ * state of that game. what names the game: empty for the busiest game in
+ * p's shard, "S.R" for room R of shard S, or otherwise the name of a
+ * player in it. A game in another shard is watched from that shard, so
+ * the connection is handed there, searching each shard in turn for a
+ * player. Input sent after the request is dropped in that case.
+ */
+void start_watching(struct client *p, char *what) {
+    struct shard *s = p->room->shard;
+    struct room *target = p->room;
+    int shard_id, room_id, end = 0;
+
+    // Updates are shared text messages, with no binary form
+    if (p->binary) {
+        write_msg("Spectators must use the text protocol.\r\n", p);
+        return;
+    }
+
+    while (*what == ' ') {
+        what++;
+    }
+    if (*what == '\0') {
+        for (struct room *room = s->rooms; room != NULL; room = room->next) {
+            if (room->num_players > target->num_players) {
+                target = room;
+            }
+        }
+    } else if (sscanf(what, "%d.%d%n", &shard_id, &room_id, &end) == 2 &&
+               what[end] == '\0') {
+        if (shard_id < 0 || shard_id >= num_shards) {
+            write_msg("No such room.\r\nYour name?\r\n", p);
+            return;
+        }
+        if (shard_id != s->id) {
+            struct handoff h = {p->fd, p->ipaddr, 0, 0, 1, room_id, "", 0};
+            give_up_connection(p);
+            send_handoff(shard_id, &h);
+            return;
+        }
+        target = find_room(s, room_id, NULL);
+        if (target == NULL) {
+            write_msg("No such room.\r\nYour name?\r\n", p);
+            return;
+        }
+    } else {
+        target = find_room(s, 0, what);
+        if (target == NULL && num_shards > 1) {
+            struct handoff h = {p->fd, p->ipaddr, 0, 0, 1, -1, "", 1};
+            strncpy(h.watch_name, what, MAX_NAME - 1);
+            give_up_connection(p);
+            send_handoff((s->id + 1) % num_shards, &h);
+            return;
+        }
+        if (target == NULL) {
+            write_msg("Nobody by that name is playing.\r\nYour name?\r\n", p);
+            return;
         }
+    }
+
+    // Spectators don't take up a seat, and are never timed out
+    temp_remove_player(&p->room->new_players, p);
+    p->room->num_clients--;
+    timer_cancel(&s->timers, &p->idle);
+    p->room = target;
+    p->spectator = 1;
+    p->next = target->spectators;
+    target->spectators = p;
+    greet_spectator(p, target);
+}
+
+/*
+ * Handles a line of input from an active player p: a guess if it is
+ * their turn, otherwise a reminder that it isn't.
+ */
+void handle_guess(struct client *p, struct game_state *game, char *line) {
+    char msg[MAX_MSG];
+    int reset = 0;
+
+    p->room->shard->guesses++;
 
-        if (FD_ISSET(listenfd, &rset)){
-            printf("A new client is connecting\n");
-            clientfd = accept_connection(listenfd);
-
-            FD_SET(clientfd, &allset);
-            if (clientfd > maxfd) {
-                maxfd = clientfd;
-            }
-            printf("Connection from %s\n", inet_ntoa(q.sin_addr));
-            add_player(&new_players, clientfd, q.sin_addr);
-            char *greeting = WELCOME_MSG;
-            if(write(clientfd, greeting, strlen(greeting)) == -1) {
-                fprintf(stderr, "Write to client %s failed\n", inet_ntoa(q.sin_addr));
-                remove_player(&new_players, clientfd);
-            };
-        }
-        
-        /* Check which other socket descriptors have something ready to read.
-         * The reason we iterate over the rset descriptors at the top level and
-         * search through the two lists of clients each time is that it is
-         * possible that a client will be removed in the middle of one of the
-         * operations. This is also why we call break after handling the input.
-         * If a client has been removed the loop variables may not longer be 
-         * valid.
-         */
-        int cur_fd;
-        for(cur_fd = 0; cur_fd <= maxfd; cur_fd++) {
-            if(FD_ISSET(cur_fd, &rset)) {
-                // Check if this socket descriptor is an active player
-                for(p = game.head; p != NULL; p = p->next) {
-                    if(cur_fd == p->fd) {
-                        char msg[MAX_MSG];
-                        int num_read = read(cur_fd, p->in_ptr, MAX_BUF - 1);
-                        
-                        // Check for client disconnect
-                        if (num_read <= 0) {
-                            if (num_read == 0) {
-                                printf("[%d] Read %d bytes\n", p->fd, num_read);
-                            }
-
-                            printf("Disconnected from %s\n", inet_ntoa(p->ipaddr));
-
-                            // If we are removing the client whose turn it is, we need to advance the turn first
-                            if (game.has_next_turn == p) {
-                                advance_turn(&game);
-                            }
-
-                            remove_player(&game.head, cur_fd);
-
-                            // Make sure game is playable for any clients in new_players
-                            if (game.head == NULL) {
-                                game.has_next_turn = NULL;
-                            }
-                            
-                            // Notify other clients of disconnect
-                            sprintf(msg, "Goodbye %s.\r\n", p->name);
-                            broadcast(&game, msg);
-                            announce_turn(&game);
-                        } else {
-                            printf("[%d] Read %d bytes\n", p->fd, num_read);
-
-                            // Look for newline
-                            p->in_ptr[num_read] = '\0';
-                            int newline = find_network_newline(p->inbuf, strlen(p->inbuf));
-
-                            // No newline, update in_ptr for future reads
-                            if (newline == -1) {
-                                p->in_ptr += num_read;
-                            } else {
-                                // Null terminate before newline
-                                p->inbuf[newline - 1] = '\0';
-                                p->in_ptr = p->inbuf;
-                                
-                                printf("[%d] Found newline %s\n", p->fd, p->inbuf);
-                                int reset = 0;
-
-                                // Check for players making guesses out of turn
-                                if (game.has_next_turn != p) {
-                                    strcpy(msg, "It's not your turn.\r\n");
-                                    write_msg(msg, p, &game);
-                                    printf("%s made a guess out of turn.\n", p->name);
-                                } else {
-                                    // Check the guess, switch on the output
-                                    int valid_guess = check_guess(p->inbuf, &game);
-                                    int correct;
-
-                                    switch(valid_guess) {
-                                        // Guess is valid
-                                        case 0:
-                                            // Make guess, evaluate for game over
-                                            // If game is over, set reset for later conditional
-                                            correct = make_guess(&game, p->inbuf[0]);
-                                            int game_over = check_game_over(&game);
-
-                                            // Game ends without winner.
-                                            if (game_over == 2) {
-                                                sprintf(msg, "No more guesses. The word was %s.\r\n", game.word);
-                                                broadcast(&game, msg);
-                                                reset = 1;
-                                            // Game ends with winner.
-                                            } else if (game_over == 1) {
-                                                sprintf(msg, "The word was %s.\r\n", game.word);
-                                                broadcast(&game, msg);
-
-                                                // Different print statements for different clients
-                                                sprintf(msg, "Game over! You win!\r\n");
-                                                write_msg(msg, game.has_next_turn, &game);
-
-                                                sprintf(msg, "Game over! %s won!\r\n", game.has_next_turn->name);
-                                                printf("Game over! %s won\n", p->name);
-                                                for (struct client *curr = game.head; curr; curr = curr->next) {
-                                                    if (curr != game.has_next_turn) {
-                                                        write_msg(msg, curr, &game);
-                                                    }
-                                                }
-
-                                                reset = 1;
-                                            // Game is still active.
-                                            } else {
-                                                // Broadcast the guess that was made, then broadcast updated status
-                                                sprintf(msg, "%s guesses %c.\r\n", p->name, p->inbuf[0]);
-                                                broadcast(&game, msg);
-                                                status_message(msg, &game);
-                                                broadcast(&game, msg);
-
-                                                // Only advance the turn if the guess was incorrect
-                                                if (!correct) {
-                                                    advance_turn(&game);
-                                                } 
-                                            }
-                                            break;
-                                        // Guess is an invalid character.
-                                        case 1:
-                                            sprintf(msg, "Guesses must be a single character between a and z.\r\n");
-                                            write_msg(msg, p, &game);
-                                            printf("%s made an invalid guess.\n", p->name);
-                                            break;
-                                        // Guess has already been made.
-                                        case 2:
-                                            sprintf(msg, "That letter has already been guessed!\r\n");
-                                            write_msg(msg, p, &game);
-                                            printf("%s made an invalid guess.\n", p->name);
-                                            break;
-                                    }
-                                    // Game is over
-                                    if (reset) {
-                                        // Print server message
-                                        printf("New game\n");
-
-                                        // Broadcast new game messages to clients, advance turn for new game
-                                        broadcast(&game, " \r\n");
-                                        broadcast(&game, "Let's start a new game.\r\n");
-                                        advance_turn(&game);
-
-                                        // Initialize new game
-                                        init_game(&game, argv[1]);
-                                        status_message(msg, &game);
-                                        broadcast(&game, msg);
-                                    }
-                                    // Announce turn, prompt for guess
-                                    announce_turn(&game);
-                                }
-                            }
-                        }
-                        break;
-                    }
+    // Check for players making guesses out of turn
+    if (game->has_next_turn != p) {
+        strcpy(msg, "It's not your turn.\r\n");
+        write_msg(msg, p);
+        log_msg(LOG_DEBUG, "%s made a guess out of turn.\n", p->name);
+        return;
+    }
+
+    // Check the guess, switch on the output
+    int valid_guess = check_guess(line, game);
+    int correct;
+
+    switch(valid_guess) {
+        // Guess is valid
+        case 0:
+            // Make guess, evaluate for game over
+            // If game is over, set reset for later conditional
+            correct = make_guess(game, line[0]);
+            int game_over = check_game_over(game);
+
+            // Every valid guess earns a fresh turn deadline
+            room_of(game)->turn_owner = NULL;
+
+            // Game ends without winner.
+            if (game_over == 2) {
+                sprintf(msg, "No more guesses. The word was %s.\r\n", game->word);
+                broadcast_text(game, msg, NULL);
+                broadcast_over(game, NULL);
+                reset = 1;
+            // Game ends with winner.
+            } else if (game_over == 1) {
+                sprintf(msg, "The word was %s.\r\n", game->word);
+                broadcast_text(game, msg, NULL);
+
+                // Different print statements for different clients
+                if (!p->binary) {
+                    sprintf(msg, "Game over! You win!\r\n");
+                    write_msg(msg, game->has_next_turn);
                 }
-        
-                // Check if any new players are entering their names
-                for(p = new_players; p != NULL; p = p->next) {
-                    if(cur_fd == p->fd) {
-                        int num_read = read(cur_fd, p->in_ptr, MAX_BUF - 1);
-                        
-                        // Check for client disconnect.
-                        if (num_read <= 0) {
-                            printf("[%d] Read %d bytes\n", p->fd, num_read);
-                            printf("Disconnected from %s\n", inet_ntoa(p->ipaddr));
-                            remove_player(&new_players, cur_fd);
-                        } else {
-                            printf("[%d] Read %d bytes\n", p->fd, num_read);
-
-                            // Look for newline
-                            p->in_ptr[num_read] = '\0';
-                            int newline = find_network_newline(p->inbuf, strlen(p->inbuf));
-
-                            // If no newline is found, update in_ptr for later reads
-                            if (newline == -1) {
-                                p->in_ptr += num_read;
-                            } else {
-                                p->inbuf[newline - 1] = '\0';
-                                p->in_ptr = p->inbuf;
-
-                                printf("[%d] Found newline %s\n", p->fd, p->inbuf);
-                                
-                                // Check if name is valid
-                                int valid_name = check_name(p->inbuf, &game);
-
-                                if (valid_name == 0) {
-                                    // If name is valid, update name field and move them to active players
-                                    temp_remove_player(&new_players, p->fd);
-                                    p->next = game.head;
-                                    game.head = p;
-                                    strcpy(p->name, p->inbuf);
-
-                                    // Handle turn order for first connected client
-                                    if (game.has_next_turn == NULL) {
-                                        game.has_next_turn = p;
-                                    } 
-
-                                    // Notify all active clients of new connection, print to server.
-                                    char msg[MAX_MSG];
-                                    sprintf(msg, "%s has just joined.\r\n", p->name);
-                                    broadcast(&game, msg);
-                                    printf("%s", msg);
-
-                                    // Write status of game to new player.
-                                    status_message(msg, &game);
-                                    write_msg(msg, p, &game);
-
-                                    // Announce the turn again
-                                    announce_turn(&game);
-                                } else {
-                                    // Notify client the name is invalid
-                                    char *msg = "Name is taken or too long.\r\n";
-                                    int num_written = write(cur_fd, msg, strlen(msg));
-
-                                    // Handle disconnect
-                                    if (num_written == -1 || num_written != strlen(msg)) {
-                                        printf("Disconnected from %s\n", inet_ntoa(p->ipaddr));
-                                        remove_player(&new_players, cur_fd);
-                                    }
-
-                                    // Write server message and prompt for name again
-                                    printf("[%d] Invalid name\n", cur_fd);
-                                    sprintf(msg, "Your name?\r\n");
-                                    num_written = write(cur_fd, msg, strlen(msg));
-
-                                    // Handle disconnect
-                                    if (num_written == -1 || num_written != strlen(msg)) {
-                                        printf("Disconnected from %s\n", inet_ntoa(p->ipaddr));
-                                        remove_player(&new_players, cur_fd);
-                                    }
-                                }   
-                            }
-                        }
-                        break;
-                    } 
+
+                sprintf(msg, "Game over! %s won!\r\n", p->name);
+                log_msg(LOG_INFO, "Game over! %s won\n", p->name);
+                broadcast_text(game, msg, p);
+                broadcast_over(game, p);
+
+                reset = 1;
+            // Game is still active.
+            } else {
+                // Broadcast the guess that was made, with the updated status
+                broadcast_guess(game, line[0]);
+
+                // Only advance the turn if the guess was incorrect
+                if (!correct && game->has_next_turn == p) {
+                    advance_turn(game);
                 }
             }
+            break;
+        // Guess is an invalid character.
+        case 1:
+            sprintf(msg, "Guesses must be a single character between a and z.\r\n");
+            write_msg(msg, p);
+            log_msg(LOG_DEBUG, "%s made an invalid guess.\n", p->name);
+            break;
+        // Guess has already been made.
+        case 2:
+            sprintf(msg, "That letter has already been guessed!\r\n");
+            write_msg(msg, p);
+            log_msg(LOG_DEBUG, "%s made an invalid guess.\n", p->name);
+            break;
+    }
+    // Game is over
+    if (reset) {
+        // Print server message
+        log_msg(LOG_INFO, "New game\n");
+        print_stats(p->room->shard);
+
+        // Broadcast new game messages to clients, advance turn for new game
+        broadcast_text(game, " \r\n", NULL);
+        broadcast_text(game, "Let's start a new game.\r\n", NULL);
+        if (game->has_next_turn != NULL) {
+            advance_turn(game);
         }
+
+        // Initialize new game
+        init_game(game, current_dictionary());
+        broadcast_status(game);
     }
-    return 0;
+    // Announce turn, prompt for guess
+    announce_turn(game);
+    notify_spectators(room_of(game));
+}
+
+/*
+ * Returns a new resume token for a player in shard s. It is random, apart
+ * from the shard's id in the top bits, so that a reconnection can be
+ * sent to the shard holding the seat.
+ */
+unsigned long long new_token(struct shard *s) {
+    unsigned long long token;
+    if (getrandom(&token, sizeof(token), 0) != sizeof(token)) {
+        perror("getrandom");
+        exit(1);
+    }
+    token &= (1ULL << TOKEN_SHARD_SHIFT) - 1;
+    // 0 means no token, so never hand it out
+    if (token == 0) {
+        token = 1;
+    }
+    return token | (unsigned long long)s->id << TOKEN_SHARD_SHIFT;
 }
 
+/*
+ * Gives player p a resume token and tells them what it is.
+ */
+void issue_token(struct client *p) {
+    char msg[MAX_MSG];
+    p->token = new_token(p->room->shard);
+    sprintf(msg, "Your resume token is %016llx.\r\n", p->token);
+    write_msg(msg, p);
+}
+
+/*
+ * Gives up the seat of a held player who did not come back in time.
+ */
+void hold_expired(struct timer *t) {
+    struct client *p = (struct client *)((char *)t - offsetof(struct client, idle));
+    log_msg(LOG_INFO, "%s did not come back\n", p->name);
+    mark_closing(p);
+}
 
+/*
+ * Puts player p, which has no connection, on its shard's list of held
+ * players, and gives up its seat after delay_ms.
+ */
+void hold_seat(struct client *p, unsigned long delay_ms) {
+    struct shard *s = p->room->shard;
+
+    p->held = 1;
+    p->held_next = s->held;
+    s->held = p;
+    timer_cancel(&s->timers, &p->idle);
+    timer_init(&p->idle, hold_expired);
+    timer_add(&s->timers, &p->idle, delay_ms);
+}
+
+/*
+ * Keeps the seat and turn position of player p, whose connection has
+ * gone, for grace_period seconds so that they can resume with their
+ * token. The other players are not told unless the seat is given up.
+ */
+void hold_player(struct client *p) {
+    struct shard *s = p->room->shard;
+
+    log_msg(LOG_INFO, "%s dropped; holding their seat\n", p->name);
+    if (recording) {
+        record_event(REC_CLOSE, p->fd, NULL, 0);
+    }
+    close_client(p);
+    p->fd = -1;
+    outq_clear(&p->outq);
+    linebuf_clear(&p->in, &s->inbufs);
+    p->want_write = 0;
+    hold_seat(p, grace_period * 1000UL);
+}
+
+/*
+ * Takes held player p off its shard's list of held players and stops the
+ * clock on its seat.
+ */
+void unhold_player(struct client *p) {
+    struct shard *s = p->room->shard;
+    struct client **h;
+
+    for (h = &s->held; *h != p; h = &(*h)->held_next)
+        ;
+    *h = p->held_next;
+    p->held = 0;
+    timer_cancel(&s->timers, &p->idle);
+    timer_init(&p->idle, idle_expired);
+}
+
+/*
+ * Returns the held player in shard s with the given token, or NULL.
+ */
+struct client *find_held(struct shard *s, unsigned long long token) {
+    for (struct client *p = s->held; p != NULL; p = p->held_next) {
+        if (p->token == token) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Gives held player p the connection fd from addr, which speaks the
+ * binary protocol if binary is 1, and brings them back up to date with
+ * the game.
+ */
+void resume_seat(struct client *p, int fd, struct in_addr addr, int binary) {
+    struct game_state *game = &p->room->game;
+    char msg[MAX_MSG];
+
+    unhold_player(p);
+    p->fd = fd;
+    p->ipaddr = addr;
+    p->binary = binary;
+    linebuf_clear(&p->in, &p->room->shard->inbufs);
+    if (watch_client(p) < 0) {
+        return;
+    }
+    arm_idle_timer(p);
+    log_msg(LOG_INFO, "%s resumed their seat\n", p->name);
+
+    sprintf(msg, "Welcome back, %s.\r\n", p->name);
+    write_msg(msg, p);
+    send_status(p);
+    tell_turn(p, game);
+}
+
+/*
+ * Takes the connection from client p in new_players without closing it,
+ * so that it can be handed on. p is only freed at the end of the loop
+ * iteration; marking it closing stops the caller reading any more of its
+ * input.
+ */
+void give_up_connection(struct client *p) {
+    struct shard *s = p->room->shard;
+
+    unwatch_client(p);
+    temp_remove_player(&p->room->new_players, p);
+    timer_cancel(&s->timers, &p->idle);
+    outq_clear(&p->outq);
+    p->room->num_clients--;
+    __atomic_fetch_sub(&s->load, 1, __ATOMIC_RELAXED);
+    p->fd = -1;
+    p->closing = 1;
+    p->reap_next = s->graveyard;
+    s->graveyard = p;
+}
+
+/*
+ * Hands the connection in h to shard target, closing it if that fails.
+ */
+void send_handoff(int target, struct handoff *h) {
+    struct shard *t = &shards[target];
+
+    __atomic_fetch_add(&t->load, 1, __ATOMIC_RELAXED);
+    if (write(t->notify[1], h, sizeof(*h)) != sizeof(*h)) {
+        perror("write to shard");
+        __atomic_fetch_sub(&t->load, 1, __ATOMIC_RELAXED);
+        close(h->fd);
+    }
+}
+
+/*
+ * Handles a resume request from client p in new_players: moves p's
+ * connection into the held seat named by the hex token, in whichever
+ * shard holds it. Input sent after the request is dropped, so a client
+ * should wait for the reply before sending more.
+ */
+void handle_resume(struct client *p, char *token_text) {
+    struct shard *s = p->room->shard;
+    unsigned long long token = strtoull(token_text, NULL, 16);
+    int target = token >> TOKEN_SHARD_SHIFT;
+    struct client *seat = NULL;
+
+    if (target == s->id) {
+        seat = find_held(s, token);
+    }
+    if (token == 0 || target >= num_shards || (target == s->id && seat == NULL)) {
+        log_msg(LOG_DEBUG, "[%d] Unknown resume token\n", p->fd);
+        write_msg("No seat is held for that token.\r\nYour name?\r\n", p);
+        return;
+    }
+
+    struct handoff h = {p->fd, p->ipaddr, token, p->binary, 0, -1, "", 0};
+    give_up_connection(p);
+    if (seat != NULL) {
+        // The seat was already counted in the shard's load
+        resume_seat(seat, h.fd, h.addr, h.binary);
+        return;
+    }
+    send_handoff(target, &h);
+}
+
+/*
+ * Handles a line of input from client p in new_players, which should be
+ * the name they want to play under.
+ */
+void handle_name(struct client *p, struct game_state *game, char *line) {
+    // A returning player takes back their seat instead of joining
+    if (strncmp(line, RESUME_CMD, strlen(RESUME_CMD)) == 0) {
+        handle_resume(p, line + strlen(RESUME_CMD));
+        return;
+    }
+    if (strncmp(line, WATCH_CMD, strlen(WATCH_CMD)) == 0 &&
+        (line[strlen(WATCH_CMD)] == '\0' || line[strlen(WATCH_CMD)] == ' ')) {
+        start_watching(p, line + strlen(WATCH_CMD));
+        return;
+    }
+    join_game(p, game, line);
+}
+
+/*
+ * Moves client p from new_players into game as a player called name, if
+ * the name is free.
+ */
+void join_game(struct client *p, struct game_state *game, char *name) {
+    char msg[MAX_MSG];
+
+    // Check if name is valid
+    if (check_name(name, game) != 0) {
+        // Notify client the name is invalid and prompt for name again
+        log_msg(LOG_DEBUG, "[%d] Invalid name\n", p->fd);
+        strcpy(msg, "Name is taken or too long.\r\nYour name?\r\n");
+        write_msg(msg, p);
+        return;
+    }
+
+    // If name is valid, update name field and move them to active players
+    temp_remove_player(&p->room->new_players, p);
+    p->next = game->head;
+    game->head = p;
+    strcpy(p->name, name);
+    nameset_add(&game->names, p);
+    p->room->num_players++;
+
+    // Handle turn order for first connected client
+    if (game->has_next_turn == NULL) {
+        game->has_next_turn = p;
+    } 
+
+    // Notify all active clients of new connection, print to server.
+    sprintf(msg, "%s has just joined.\r\n", p->name);
+    broadcast(game, msg);
+    log_msg(LOG_INFO, "%s has just joined.\n", p->name);
+
+    // Write status of game to new player.
+    send_status(p);
+    if (grace_period > 0) {
+        issue_token(p);
+    }
+
+    // Announce the turn again
+    announce_turn(game);
+}
+
+/*
+ * Restarts the idle timer of client p: a client with no name yet has
+ * name_timeout seconds to give one, and a player must send something at
+ * least every idle_timeout seconds. Spectators may stay silent.
+ */
+void arm_idle_timer(struct client *p) {
+    if (p->spectator) {
+        return;
+    }
+    int timeout = (p->name[0] == '\0') ? name_timeout : idle_timeout;
+    if (timeout > 0) {
+        timer_add(&p->room->shard->timers, &p->idle, timeout * 1000UL);
+    }
+}
+
+/*
+ * Disconnects a client whose idle timer has fired.
+ */
+void idle_expired(struct timer *t) {
+    struct client *p = (struct client *)((char *)t - offsetof(struct client, idle));
+
+    if (p->fd == -1 || p->closing) {
+        return;
+    }
+    if (p->name[0] == '\0') {
+        write_msg("Timed out waiting for your name.\r\n", p);
+    } else {
+        write_msg("Disconnected for being idle.\r\n", p);
+    }
+    log_msg(LOG_INFO, "[%d] Idle timeout\n", p->fd);
+    mark_closing(p);
+}
+
+/*
+ * Passes the turn on when the player whose turn it is has not guessed in
+ * time.
+ */
+void turn_expired(struct timer *t) {
+    struct room *room = (struct room *)((char *)t - offsetof(struct room, turn_timer));
+    struct game_state *game = &room->game;
+    char msg[MAX_MSG];
+
+    if (game->has_next_turn == NULL) {
+        return;
+    }
+    log_msg(LOG_INFO, "%s ran out of time\n", game->has_next_turn->name);
+    sprintf(msg, "%s took too long.\r\n", game->has_next_turn->name);
+    broadcast(game, msg);
+    advance_turn(game);
+
+    // The same player may get the turn back if they are alone
+    room->turn_owner = NULL;
+    announce_turn(game);
+}
+
+/*
+ * Records the num_read bytes just read into the input buffer of p, which
+ * may wrap around the end of the buffer.
+ */
+void record_input(struct client *p, int num_read) {
+    char data[LINEBUF_SIZE];
+    for (int i = 0; i < num_read; i++) {
+        data[i] = p->in.data[(p->in.end - num_read + i) & (LINEBUF_SIZE - 1)];
+    }
+    record_event(REC_INPUT, p->fd, data, num_read);
+}
+
+/*
+ * Handles the end of client p's connection. A player's seat is kept for
+ * a while in case they reconnect.
+ */
+void connection_lost(struct client *p) {
+    if (p->name[0] != '\0' && grace_period > 0) {
+        hold_player(p);
+    } else {
+        mark_closing(p);
+    }
+}
+
+/*
+ * Handles a line of input from client p.
+ */
+void handle_line(struct client *p, char *line) {
+    // Clients without a name are still in new_players. Look again
+    // for each line, since a name may be followed by a guess.
+    if (p->spectator) {
+        write_msg("Spectators can't play.\r\n", p);
+    } else if (p->name[0] != '\0') {
+        handle_guess(p, &p->room->game, line);
+    } else {
+        handle_name(p, &p->room->game, line);
+    }
+}
+
+/*
+ * Handles a frame of len bytes from client p, which speaks the binary
+ * protocol. The frame is followed by a null byte, so the text it carries
+ * can be used as a string.
+ */
+void handle_frame(struct client *p, char *frame, int len) {
+    struct bin_hdr *hdr = (struct bin_hdr *)frame;
+    char *body = frame + sizeof(struct bin_hdr);
+
+    switch (hdr->type) {
+    case BIN_HELLO:
+        if (len != sizeof(struct bin_hello) ||
+            ((struct bin_hello *)frame)->version != BIN_VERSION) {
+            write_msg("Unsupported protocol version.\r\n", p);
+            mark_closing(p);
+        } else {
+            struct msg *m = bin_frame(BIN_HELLO, body, 1);
+            send_msg(m, p);
+            msg_unref(m);
+        }
+        break;
+    case BIN_TEXT:
+        handle_line(p, body);
+        break;
+    case BIN_JOIN:
+        if (p->spectator || p->name[0] != '\0') {
+            write_msg("You have already joined.\r\n", p);
+        } else {
+            join_game(p, &p->room->game, body);
+        }
+        break;
+    case BIN_GUESS:
+        // Anything but one letter is an invalid guess, as it would be
+        // from a text client
+        if (p->spectator) {
+            write_msg("Spectators can't play.\r\n", p);
+        } else if (p->name[0] == '\0') {
+            write_msg("Join before guessing.\r\n", p);
+        } else {
+            handle_guess(p, &p->room->game, body);
+        }
+        break;
+    default:
+        log_msg(LOG_INFO, "[%d] Unknown frame %d\n", p->fd, hdr->type);
+        write_msg("Unknown frame.\r\n", p);
+        mark_closing(p);
+    }
+}
+
+/*
+ * Handles every complete line in the input of client p, after num_read
+ * more bytes have arrived in its buffer, so commands sent together are
+ * not lost.
+ */
+void handle_lines(struct client *p, int num_read) {
+    char line[LINEBUF_SIZE];
+
+    stat_add(p->room->shard->stats.bytes_in, num_read);
+    if (recording) {
+        record_input(p, num_read);
+    }
+
+    // A binary client opens with a frame, whose first byte is always 0,
+    // where a text client would start a line
+    if (!p->binary && p->in.start == 0 && p->in.end > 0 && p->in.data[0] == '\0') {
+        p->binary = 1;
+    }
+
+    int found;
+    while (p->binary && !p->closing && (found = linebuf_frame(&p->in, line)) != 0) {
+        if (found == -1) {
+            log_msg(LOG_INFO, "[%d] Bad frame\n", p->fd);
+            write_msg("Bad frame.\r\n", p);
+            mark_closing(p);
+            break;
+        }
+        stat_add(p->room->shard->stats.lines, 1);
+        handle_frame(p, line, found);
+    }
+    while (!p->binary && !p->closing && (found = linebuf_next(&p->in, line)) != 0) {
+        if (found == -1) {
+            log_msg(LOG_INFO, "[%d] Line too long\n", p->fd);
+            write_msg("Line too long.\r\n", p);
+            continue;
+        }
+        log_msg(LOG_DEBUG, "[%d] Found newline %s\n", p->fd, line);
+        stat_add(p->room->shard->stats.lines, 1);
+        handle_line(p, line);
+    }
+
+    // Restart the clock only now, since the lines may have named p
+    if (!p->closing) {
+        arm_idle_timer(p);
+    }
+    linebuf_done(&p->in, &p->room->shard->inbufs);
+}
+
+/*
+ * Reads what client p has sent and handles it.
+ */
+void handle_input(struct client *p) {
+    int num_read = linebuf_read(&p->in, p->fd, &p->room->shard->inbufs);
+    if (num_read < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    log_msg(LOG_DEBUG, "[%d] Read %d bytes\n", p->fd, num_read);
+    if (num_read <= 0) {
+        connection_lost(p);
+        return;
+    }
+    handle_lines(p, num_read);
+}
+
+/* With io_uring, each connection has a multishot recv that reads into
+ * the shard's buffer ring, and a send of its queued output whenever
+ * there is some. A request may still complete after its client has let
+ * go of it, because the connection was closed or handed to another
+ * shard: its owner is then NULL and it only cleans up after itself.
+ */
+struct conn_op {
+    struct uring_op op;
+    struct shard *shard;
+    struct client *owner;
+};
+
+struct send_op {
+    struct conn_op c;
+    struct out_queue orphan;    // The client's output, if the client let
+                                // go of it while the kernel might still
+                                // be reading it
+    struct msghdr hdr;
+    struct iovec iov[];         // Point into the queue being sent
+};
+
+void recv_done(struct uring_op *op, struct io_uring_cqe *cqe);
+void send_done(struct uring_op *op, struct io_uring_cqe *cqe);
+
+/*
+ * Asks the ring of client p's shard to read from p's connection until it
+ * ends, taking a buffer for each read.
+ */
+void start_recv(struct client *p) {
+    struct shard *s = p->room->shard;
+    if (p->recv == NULL) {
+        p->recv = malloc(sizeof(struct conn_op));
+        if (p->recv == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        p->recv->op.done = recv_done;
+        p->recv->shard = s;
+        p->recv->owner = p;
+    }
+    struct io_uring_sqe *sqe = uring_sqe(&s->ring, &p->recv->op);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = p->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = s->bufs.group;
+}
+
+/*
+ * Handles the len bytes at data received from client p, as much as fits
+ * in its line buffer at a time, until all of it is used or p is closed.
+ */
+void handle_data(struct client *p, const char *data, int len) {
+    while (len > 0 && p->fd != -1 && !p->closing) {
+        int n = linebuf_put(&p->in, data, len, &p->room->shard->inbufs);
+        if (n == 0) {
+            break;
+        }
+        handle_lines(p, n);
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * Handles a completion of the read of a client's connection: input, or
+ * the end of the connection. A read that stopped early for lack of
+ * buffers is started again.
+ */
+void recv_done(struct uring_op *op, struct io_uring_cqe *cqe) {
+    struct conn_op *c = (struct conn_op *)op;
+    struct shard *s = c->shard;
+
+    if (c->owner != NULL && cqe->res > 0) {
+        log_msg(LOG_DEBUG, "[%d] Read %d bytes\n", c->owner->fd, cqe->res);
+        handle_data(c->owner, uring_buf(&s->bufs, cqe), cqe->res);
+    }
+    uring_buf_return(&s->bufs, cqe);
+
+    // Handling the input may have closed the client or handed it on
+    struct client *p = c->owner;
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        int ended = cqe->res == 0 ||
+                    (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED);
+        if (p != NULL && !ended && cqe->res != -ECANCELED && !p->closing && !s->frozen) {
+            start_recv(p);
+        } else {
+            if (p != NULL) {
+                p->recv = NULL;
+            }
+            free(c);
+            if (p != NULL && ended && !p->closing) {
+                connection_lost(p);
+            }
+        }
+    }
+    reap_closing(s);
+}
+
+/*
+ * Prepares a send of the output queued for client p, as much of it as
+ * one sendmsg takes, with the given MSG_* and IOSQE_* flags. The output
+ * stays in p's queue until the send completes.
+ */
+struct send_op *queue_send(struct client *p, int msg_flags, int sqe_flags) {
+    struct shard *s = p->room->shard;
+    struct iovec iov[OUTQ_IOV];
+    int n = outq_peek(&p->outq, iov, OUTQ_IOV);
+
+    struct send_op *op = malloc(sizeof(struct send_op) + n * sizeof(struct iovec));
+    if (op == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    op->c.op.done = send_done;
+    op->c.shard = s;
+    op->c.owner = p;
+    outq_init(&op->orphan);
+    memcpy(op->iov, iov, n * sizeof(struct iovec));
+    memset(&op->hdr, 0, sizeof(op->hdr));
+    op->hdr.msg_iov = op->iov;
+    op->hdr.msg_iovlen = n;
+
+    struct io_uring_sqe *sqe = uring_sqe(&s->ring, &op->c.op);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = p->fd;
+    sqe->addr = (unsigned long)&op->hdr;
+    sqe->len = 1;
+    sqe->msg_flags = msg_flags;
+    sqe->flags = sqe_flags;
+    outq_stats.writes++;
+    return op;
+}
+
+/*
+ * Starts writing the output queued for client p.
+ */
+void start_send(struct client *p) {
+    p->send = queue_send(p, 0, 0);
+    p->want_write = 1;
+}
+
+/*
+ * Handles the completion of a send: drops what was written from the
+ * client's queue, and has the rest written at the end of the iteration.
+ * A failed send disconnects the client.
+ */
+void send_done(struct uring_op *op, struct io_uring_cqe *cqe) {
+    struct send_op *send = (struct send_op *)op;
+    struct shard *s = send->c.shard;
+    struct client *p = send->c.owner;
+
+    if (p == NULL) {
+        if (cqe->res > 0) {
+            outq_consume(&send->orphan, cqe->res);
+        }
+        outq_clear(&send->orphan);
+        free(send);
+        return;
+    }
+    free(send);
+    p->send = NULL;
+    p->want_write = 0;
+    if (cqe->res >= 0) {
+        outq_consume(&p->outq, cqe->res);
+        hist_record(&s->stats.outq_bytes, p->outq.bytes);
+        if (p->outq.bytes > 0) {
+            cork_client(p);
+        } else {
+            caught_up(p);
+        }
+    } else if (cqe->res != -ECANCELED) {
+        mark_closing(p);
+        reap_closing(s);
+    }
+}
+
+/*
+ * Lets go of the requests on client p's connection and cancels them.
+ * Output being sent goes with the send, since the kernel may still be
+ * reading it.
+ */
+void detach_requests(struct client *p) {
+    struct shard *s = p->room->shard;
+
+    if (p->recv != NULL) {
+        p->recv->owner = NULL;
+        p->recv = NULL;
+    }
+    if (p->send != NULL) {
+        p->send->c.owner = NULL;
+        p->send->orphan = p->outq;
+        outq_init(&p->outq);
+        p->send = NULL;
+        p->want_write = 0;
+    }
+    struct io_uring_sqe *sqe = uring_sqe(&s->ring, NULL);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = p->fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+/*
+ * Starts reading client p's connection. With io_uring, a shard that is
+ * not running yet starts reading its connections when it starts. If the
+ * connection cannot be watched, it is treated as lost, so only that
+ * client goes, and -1 is returned; otherwise 0.
+ */
+int watch_client(struct client *p) {
+    struct shard *s = p->room->shard;
+    if (!use_uring) {
+        if (loop_add(s->epfd, p->fd, p, EPOLLIN) < 0) {
+            log_msg(LOG_ERROR, "[%d] Cannot watch the connection\n", p->fd);
+            connection_lost(p);
+            return -1;
+        }
+    } else if (s == this_shard) {
+        start_recv(p);
+    }
+    return 0;
+}
+
+/*
+ * Stops reading client p's connection, without closing it, so that it
+ * can be handed to another shard.
+ */
+void unwatch_client(struct client *p) {
+    struct shard *s = p->room->shard;
+    if (!use_uring) {
+        loop_del(s->epfd, p->fd);
+        return;
+    }
+    // Cancel the read now, before the other shard starts its own
+    detach_requests(p);
+    uring_submit(&s->ring);
+}
+
+/*
+ * Closes client p's connection. Output is only written at the end of the
+ * iteration, so first try once to send what is left, such as the reason
+ * for closing.
+ */
+void close_client(struct client *p) {
+    struct shard *s = p->room->shard;
+
+    if (!use_uring) {
+        if (p->outq.bytes > 0) {
+            outq_flush(&p->outq, p->fd);
+        }
+        loop_del(s->epfd, p->fd);
+        close(p->fd);
+        return;
+    }
+
+    /* The last send and the close go in the same submission as the
+     * cancel, linked so the close waits for the send whether or not it
+     * succeeds. MSG_DONTWAIT keeps a client that is not reading from
+     * holding the connection open. If a send was still in flight, the
+     * rest of the output is dropped.
+     */
+    detach_requests(p);
+    if (p->outq.bytes > 0) {
+        struct send_op *send = queue_send(p, MSG_DONTWAIT, IOSQE_IO_HARDLINK);
+        send->c.owner = NULL;
+        send->orphan = p->outq;
+        outq_init(&p->outq);
+    }
+    struct io_uring_sqe *sqe = uring_sqe(&s->ring, NULL);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = p->fd;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+/*
+ * Creates an empty room in shard s with a fresh game.
+ */
+struct room *new_room(struct shard *s) {
+    struct room *room = malloc(sizeof(struct room));
+    if (room == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    room->game.version = 0;
+    room->game.status = NULL;
+    room->game.bin_status = NULL;
+    // Each room has its own generator, so that its words do not depend on
+    // how the shards' threads happen to interleave
+    room->game.rng = seed ^ (s->id * 0x9e3779b9u) ^ (s->num_rooms * 0x85ebca6bu);
+    init_game(&room->game, current_dictionary());
+    room->game.head = NULL;
+    room->game.has_next_turn = NULL;
+    nameset_init(&room->game.names);
+    room->new_players = NULL;
+    room->num_clients = 0;
+    room->num_players = 0;
+    timer_init(&room->turn_timer, turn_expired);
+    room->turn_owner = NULL;
+    room->spectators = NULL;
+    timer_init(&room->watch_timer, watch_expired);
+    room->watch_msg = NULL;
+    room->watch_version = 0;
+    room->watch_sent = 0;
+    room->watch_cursor = NULL;
+    room->id = s->num_rooms++;
+    room->shard = s;
+    room->next = s->rooms;
+    s->rooms = room;
+    log_msg(LOG_INFO, "Shard %d opened room %d\n", s->id, room->id);
+    return room;
+}
+
+/*
+ * Returns the room in shard s that a new client should join: the fullest
+ * room that still has space, so that games fill up before new ones are
+ * started. Opens a new room if every room is full.
+ */
+struct room *place_client(struct shard *s) {
+    struct room *best = NULL;
+    for (struct room *room = s->rooms; room != NULL; room = room->next) {
+        if (room->num_clients < room_size &&
+            (best == NULL || room->num_clients > best->num_clients)) {
+            best = room;
+        }
+    }
+    if (best == NULL) {
+        best = new_room(s);
+    }
+    return best;
+}
+
+/*
+ * Takes every connection the acceptor has handed to shard s, places each
+ * in a room and greets it.
+ */
+void take_connections(struct shard *s) {
+    struct handoff h;
+
+    while (read(s->notify[0], &h, sizeof(h)) == sizeof(h)) {
+        if (h.fd == -1) {
+            s->frozen = 1;
+            return;
+        }
+
+        // Another shard sent on a player resuming a seat held here
+        if (h.token != 0) {
+            struct client *seat = find_held(s, h.token);
+            if (seat != NULL) {
+                __atomic_fetch_sub(&s->load, 1, __ATOMIC_RELAXED);
+                resume_seat(seat, h.fd, h.addr, h.binary);
+                continue;
+            }
+        }
+
+        // Another shard sent on a spectator of a game it does not have
+        if (h.watch) {
+            const char *name = (h.room < 0) ? h.watch_name : NULL;
+            struct room *target = find_room(s, h.room, name);
+            if (target == NULL && name != NULL && h.hops < num_shards - 1) {
+                // Ask the next shard, until every shard has been searched
+                h.hops++;
+                __atomic_fetch_sub(&s->load, 1, __ATOMIC_RELAXED);
+                send_handoff((s->id + 1) % num_shards, &h);
+                continue;
+            }
+            if (target != NULL) {
+                // Spectators take no seat and have no timer
+                add_player(&target->spectators, h.fd, h.addr, target);
+                struct client *p = target->spectators;
+                p->spectator = 1;
+                target->num_clients--;
+                timer_cancel(&s->timers, &p->idle);
+                greet_spectator(p, target);
+                continue;
+            }
+        }
+
+        struct room *room = place_client(s);
+        log_msg(LOG_INFO, "Connection from %s to room %d.%d\n", peer_name(h.addr),
+                s->id, room->id);
+        add_player(&room->new_players, h.fd, h.addr, room);
+        room->new_players->binary = h.binary;
+        if (h.token != 0) {
+            // The seat was given up while the connection was on its way
+            write_msg("No seat is held for that token.\r\nYour name?\r\n",
+                      room->new_players);
+        } else if (h.watch) {
+            write_msg(h.room < 0 ? "Nobody by that name is playing.\r\nYour name?\r\n"
+                                 : "No such room.\r\nYour name?\r\n",
+                      room->new_players);
+        } else {
+            write_msg(WELCOME_MSG, room->new_players);
+        }
+    }
+}
+
+void notify_done(struct uring_op *op, struct io_uring_cqe *cqe);
+
+/*
+ * Asks the ring of shard s to report whenever its handoff pipe has
+ * something to read.
+ */
+void watch_notify(struct shard *s) {
+    struct io_uring_sqe *sqe = uring_sqe(&s->ring, &s->notify_op);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = s->notify[0];
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+/*
+ * Takes the connections handed to a shard once its pipe is readable.
+ */
+void notify_done(struct uring_op *op, struct io_uring_cqe *cqe) {
+    struct shard *s = (struct shard *)((char *)op - offsetof(struct shard, notify_op));
+    if (cqe->res > 0 && !s->frozen) {
+        take_connections(s);
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE) && !s->frozen) {
+        watch_notify(s);
+    }
+    reap_closing(s);
+}
+
+/*
+ * Sets up the io_uring of shard s. Returns 0 on success, and -1 with
+ * errno set if the kernel cannot provide what it needs.
+ */
+int init_ring(struct shard *s) {
+    if (uring_init(&s->ring, URING_ENTRIES, 0) < 0) {
+        return -1;
+    }
+    if (uring_bufs_init(&s->ring, &s->bufs, 0, URING_BUFS, LINEBUF_SIZE) < 0) {
+        close(s->ring.fd);
+        return -1;
+    }
+    s->notify_op.done = notify_done;
+    return 0;
+}
+
+/*
+ * Starts the requests of the ring of shard s: one for its handoff pipe,
+ * and a read for every connection not being read yet. That is all of
+ * them when the shard first starts, or starts again after a handover
+ * that failed.
+ */
+void start_ring(struct shard *s) {
+    watch_notify(s);
+    for (struct room *room = s->rooms; room != NULL; room = room->next) {
+        struct client *lists[] = {room->game.head, room->new_players, room->spectators};
+        for (int i = 0; i < 3; i++) {
+            for (struct client *p = lists[i]; p != NULL; p = p->next) {
+                if (p->fd != -1 && p->recv == NULL) {
+                    start_recv(p);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Cancels every request of the ring of shard s and waits for them all to
+ * complete, so that the shard's connections are left alone once it has
+ * stopped. Input that arrives meanwhile is handled; output not yet sent
+ * stays queued.
+ */
+void drain_ring(struct shard *s) {
+    struct io_uring_sqe *sqe = uring_sqe(&s->ring, NULL);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    while (s->ring.pending > 0) {
+        uring_wait(&s->ring, -1);
+        uring_run(&s->ring);
+        end_iteration(s);
+    }
+    // Connections closed meanwhile
+    uring_submit(&s->ring);
+}
+
+/*
+ * Prints the output counters of the calling shard: bytes formatted once
+ * per message against the bytes that were queued and sent to all of its
+ * recipients.
+ */
+void print_stats(struct shard *s) {
+    log_msg(LOG_INFO, "Shard %d output: %ld messages, %ld bytes formatted, "
+            "%ld bytes queued, %ld bytes sent in %ld writes\n", s->id,
+            outq_stats.msgs_formatted, outq_stats.bytes_formatted,
+            outq_stats.bytes_queued, outq_stats.bytes_sent, outq_stats.writes);
+}
+
+/*
+ * Return path with a worker's index added to it, so that workers sharing
+ * a command line do not share files, or NULL if path is NULL.
+ */
+char *worker_path(const char *path, int worker) {
+    if (path == NULL) {
+        return NULL;
+    }
+    char *name = malloc(strlen(path) + 16);
+    if (name == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(name, "%s.%d", path, worker);
+    return name;
+}
+
+/*
+ * Raise the soft limit on open descriptors to the hard limit, since each
+ * client holds one and the default soft limit is usually 1024.
+ */
+void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+            perror("setrlimit");
+        }
+    }
+}
+
+/*
+ * Finishes a loop iteration of shard s: disconnects the clients marked
+ * for it, writes out everything queued for the rest, and frees the
+ * clients removed. Saying goodbye queues more output, and a failed write
+ * marks another client, so this repeats until both are done.
+ */
+void end_iteration(struct shard *s) {
+    do {
+        reap_closing(s);
+        flush_corked(s);
+    } while (s->closing != NULL);
+    free_removed(s);
+}
+
+/*
+ * Handles the nready events reported by epoll to shard s.
+ */
+void handle_events(struct shard *s, struct epoll_event *events, int nready) {
+    /* Only ready descriptors are reported, each with its client, so
+     * there is no need to scan every descriptor or search the lists.
+     * A client may be removed while handling an earlier event in the
+     * batch; its fd is then -1 and it is skipped. It is not freed
+     * until the whole batch has been handled.
+     */
+    for (int i = 0; i < nready; i++) {
+        struct client *p = events[i].data.ptr;
+
+        // The handoff pipe is registered with a NULL pointer
+        if (p == NULL) {
+            take_connections(s);
+            continue;
+        }
+        if (p->fd == -1 || p->closing) {
+            continue;
+        }
+
+        // The socket has room for more of the client's queued output
+        if (events[i].events & EPOLLOUT) {
+            flush_client(p);
+        }
+
+        if (!p->closing && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            handle_input(p);
+        }
+        reap_closing(s);
+    }
+}
+
+/*
+ * Adds what the calling thread has sent since seen to the output totals
+ * of shard s, and moves seen up to date. The thread's own counters start
+ * from zero in each thread, and a shard gets a new thread when it is
+ * restarted after a failed handover, so only the difference is added.
+ */
+void add_output_stats(struct shard *s, struct outq_stats *seen) {
+    stat_add(s->stats.bytes_out, outq_stats.bytes_sent - seen->bytes_sent);
+    stat_add(s->stats.writes, outq_stats.writes - seen->writes);
+    *seen = outq_stats;
+}
+
+/*
+ * The event loop of one shard. Runs in the shard's own thread until the
+ * shard is frozen for an upgrade.
+ */
+void *shard_main(void *arg) {
+    struct shard *s = arg;
+    struct epoll_event events[MAX_EVENTS];
+    struct outq_stats seen = outq_stats;
+
+    this_shard = s;
+    if (use_uring) {
+        start_ring(s);
+    }
+    // Output queued before the shard started, by an upgrade, goes first
+    end_iteration(s);
+
+    while (!s->frozen) {
+        // Sleep no longer than it takes for the next timer to fire. The
+        // dictionary is not touched while asleep, so a reload need not
+        // wait for this shard to wake up.
+        int nready = 0;
+        __atomic_store_n(&s->waiting, 1, __ATOMIC_SEQ_CST);
+        if (use_uring) {
+            // Everything the last iteration prepared, reads, sends and
+            // closes alike, is submitted by the call that waits
+            uring_wait(&s->ring, timer_timeout(&s->timers));
+        } else {
+            nready = loop_wait(s->epfd, events, timer_timeout(&s->timers));
+        }
+        __atomic_store_n(&s->waiting, 0, __ATOMIC_SEQ_CST);
+        unsigned long woke = clock_usec();
+
+        if (use_uring) {
+            // Each completion goes to the request it belongs to
+            nready = uring_run(&s->ring);
+        } else {
+            handle_events(s, events, nready);
+        }
+        hist_record(&s->stats.events, nready);
+        timer_run(&s->timers);
+        end_iteration(s);
+        __atomic_fetch_add(&s->iterations, 1, __ATOMIC_SEQ_CST);
+
+        // Every reply to this iteration's input has now been written
+        unsigned long took = clock_usec() - woke;
+        hist_record(&s->stats.loop_usec, took);
+        for (; s->guesses > 0; s->guesses--) {
+            hist_record(&s->stats.guess_usec, took);
+        }
+        add_output_stats(s, &seen);
+    }
+    if (use_uring) {
+        drain_ring(s);
+    }
+    add_output_stats(s, &seen);
+    __atomic_store_n(&s->waiting, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+/*
+ * Sets up shard s. Its thread is started by run_shard.
+ */
+void init_shard(struct shard *s, int id) {
+    s->id = id;
+    s->rooms = NULL;
+    s->num_rooms = 0;
+    s->closing = NULL;
+    s->graveyard = NULL;
+    s->load = 0;
+    s->frozen = 0;
+    s->held = NULL;
+    s->corked = NULL;
+    s->iterations = 0;
+    s->waiting = 1;
+    memset(&s->stats, 0, sizeof(s->stats));
+    s->guesses = 0;
+    timer_wheel_init(&s->timers);
+    pool_init(&s->clients, sizeof(struct client));
+    pool_init(&s->inbufs, LINEBUF_SIZE);
+
+    if (pipe(s->notify) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    if (fcntl(s->notify[0], F_SETFL, O_NONBLOCK) < 0) {
+        perror("fcntl");
+        exit(1);
+    }
+    if (use_uring && init_ring(s) < 0) {
+        // The first shard decides for all of them
+        if (id > 0) {
+            perror("io_uring");
+            exit(1);
+        }
+        log_msg(LOG_ERROR, "io_uring is not available (%s); using epoll\n",
+                strerror(errno));
+        use_uring = 0;
+    }
+    if (!use_uring) {
+        s->epfd = loop_create();
+        if (loop_add(s->epfd, s->notify[0], NULL, EPOLLIN) < 0) {
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Starts the thread of shard s.
+ */
+void run_shard(struct shard *s) {
+    if (pthread_create(&s->thread, NULL, shard_main, s) != 0) {
+        fprintf(stderr, "Could not start shard %d\n", s->id);
+        exit(1);
+    }
+}
+
+/*
+ * Returns the shard with the fewest clients.
+ */
+struct shard *least_loaded_shard(void) {
+    struct shard *best = &shards[0];
+    int best_load = __atomic_load_n(&best->load, __ATOMIC_RELAXED);
+    for (int i = 1; i < num_shards; i++) {
+        int load = __atomic_load_n(&shards[i].load, __ATOMIC_RELAXED);
+        if (load < best_load) {
+            best = &shards[i];
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+/*
+ * Returns the dictionary a new game should take its word from.
+ */
+struct dictionary *current_dictionary(void) {
+    return __atomic_load_n(&dictionary, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Waits until no shard can still be using a dictionary that was replaced
+ * before the call: each has either finished the loop iteration it was in
+ * or is asleep between iterations.
+ */
+void wait_for_shards(void) {
+    unsigned long *seen = malloc(num_shards * sizeof(unsigned long));
+    if (seen == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < num_shards; i++) {
+        seen[i] = __atomic_load_n(&shards[i].iterations, __ATOMIC_SEQ_CST);
+    }
+    for (int i = 0; i < num_shards; i++) {
+        while (!__atomic_load_n(&shards[i].waiting, __ATOMIC_SEQ_CST) &&
+               __atomic_load_n(&shards[i].iterations, __ATOMIC_SEQ_CST) == seen[i]) {
+            usleep(1000);
+        }
+    }
+    free(seen);
+}
+
+/*
+ * Loads the dictionary file again each time sigfd reports a SIGHUP, and
+ * swaps it in for new games. The loading is done on this thread, so the
+ * shards never wait on the disk, and a file that cannot be loaded leaves
+ * the old dictionary in place. Games in progress keep their words.
+ */
+void *reload_main(void *arg) {
+    int sigfd = *(int *)arg;
+    struct signalfd_siginfo info;
+
+    while (read(sigfd, &info, sizeof(info)) == sizeof(info)) {
+        unsigned long start = timer_now_ms();
+        struct dictionary *fresh = malloc(sizeof(struct dictionary));
+        if (fresh == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        if (open_dictionary(fresh, dictionary_path) < 0) {
+            log_msg(LOG_ERROR, "Could not reload %s; keeping the old dictionary\n",
+                    dictionary_path);
+            free(fresh);
+            continue;
+        }
+
+        struct dictionary *old = __atomic_exchange_n(&dictionary, fresh, __ATOMIC_SEQ_CST);
+        log_msg(LOG_INFO, "Reloaded %s: %d words in %lu ms\n", dictionary_path,
+                fresh->size, timer_now_ms() - start);
+        wait_for_shards();
+        close_dictionary(old);
+        free(old);
+    }
+    perror("read signalfd");
+    return NULL;
+}
+
+/*
+ * Writes the server's metrics to fp as text, one per line: counters as
+ * "name value", then each histogram, merged across the shards, as its
+ * summary line followed by its buckets. Everything is read while the
+ * shards and the acceptor keep running, so the figures are each current
+ * but not taken at quite the same instant.
+ */
+void print_metrics(FILE *fp, int listenfd) {
+    struct shard_stats total;
+    long clients = 0;
+    long rooms = 0;
+    long inbufs = 0;
+    long pool_bytes = 0;
+    unsigned long iterations = 0;
+
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < num_shards; i++) {
+        struct shard *s = &shards[i];
+        clients += __atomic_load_n(&s->load, __ATOMIC_RELAXED);
+        rooms += __atomic_load_n(&s->num_rooms, __ATOMIC_RELAXED);
+        iterations += __atomic_load_n(&s->iterations, __ATOMIC_RELAXED);
+        inbufs += stat_get(s->inbufs.used);
+        pool_bytes += stat_get(s->clients.slab_bytes) + stat_get(s->inbufs.slab_bytes);
+        total.bytes_in += stat_get(s->stats.bytes_in);
+        total.bytes_out += stat_get(s->stats.bytes_out);
+        total.writes += stat_get(s->stats.writes);
+        total.lines += stat_get(s->stats.lines);
+        hist_merge(&total.events, &s->stats.events);
+        hist_merge(&total.loop_usec, &s->stats.loop_usec);
+        hist_merge(&total.guess_usec, &s->stats.guess_usec);
+        hist_merge(&total.outq_bytes, &s->stats.outq_bytes);
+    }
+
+    fprintf(fp, "uptime_sec %lu\n", (clock_usec() - started) / 1000000);
+    fprintf(fp, "shards %d\n", num_shards);
+    fprintf(fp, "clients %ld\n", clients);
+    fprintf(fp, "rooms %ld\n", rooms);
+    fprintf(fp, "input_buffers %ld\n", inbufs);
+    fprintf(fp, "pool_bytes %ld\n", pool_bytes);
+    fprintf(fp, "accepted %ld\n", stat_get(accept_stats.accepted));
+    fprintf(fp, "aborted %ld\n", stat_get(accept_stats.aborted));
+    fprintf(fp, "shed %ld\n", stat_get(accept_stats.shed));
+    fprintf(fp, "listen_queue %d\n", listen_queue_depth(listenfd));
+    fprintf(fp, "loop_iterations %lu\n", iterations);
+    fprintf(fp, "bytes_in %lu\n", total.bytes_in);
+    fprintf(fp, "bytes_out %lu\n", total.bytes_out);
+    fprintf(fp, "writes %lu\n", total.writes);
+    fprintf(fp, "lines %lu\n", total.lines);
+    hist_print(fp, "events_per_iteration", &total.events);
+    hist_print(fp, "loop_usec", &total.loop_usec);
+    hist_print(fp, "guess_usec", &total.guess_usec);
+    hist_print(fp, "outq_bytes", &total.outq_bytes);
+}
+
+/*
+ * Serves the admin socket, one connection at a time: reads a command
+ * line, answers it and closes the connection. "stats" (or an empty line)
+ * prints the metrics and "reload" reloads the dictionary as SIGHUP does.
+ * A client that sends nothing for a second gets the metrics anyway, so
+ * a plain connect is enough to read them.
+ */
+void *admin_main(void *arg) {
+    int adminfd = ((int *)arg)[0];
+    int listenfd = ((int *)arg)[1];
+    struct timeval wait = {1, 0};
+
+    while (1) {
+        int fd = accept(adminfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept admin");
+            return NULL;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+        FILE *fp = fdopen(fd, "r+");
+        if (fp == NULL) {
+            perror("fdopen");
+            close(fd);
+            continue;
+        }
+
+        char line[64];
+        if (fgets(line, sizeof(line), fp) == NULL) {
+            line[0] = '\0';
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        // Switch from reading to writing, as a stream opened "r+" requires
+        fseek(fp, 0, SEEK_CUR);
+
+        if (line[0] == '\0' || strcmp(line, "stats") == 0) {
+            print_metrics(fp, listenfd);
+        } else if (strcmp(line, "reload") == 0) {
+            kill(getpid(), SIGHUP);
+            fprintf(fp, "Reloading %s\n", dictionary_path);
+        } else {
+            fprintf(fp, "Commands: stats, reload\n");
+        }
+        fclose(fp);
+    }
+}
+
+/*
+ * Sends client p, and the output still queued for it, to a new process
+ * over upfd. Returns 0 on success and -1 if the new process went away.
+ */
+int send_client(int upfd, struct client *p, int has_turn) {
+    struct upgrade_rec rec;
+
+    rec.type = UPGRADE_CLIENT;
+    rec.u.client.addr = p->ipaddr;
+    strcpy(rec.u.client.name, p->name);
+    rec.u.client.in = p->in;
+    if (p->in.data != NULL) {
+        memcpy(rec.u.client.in_data, p->in.data, LINEBUF_SIZE);
+    }
+    rec.u.client.token = p->token;
+    rec.u.client.has_turn = has_turn;
+    rec.u.client.spectator = p->spectator;
+    rec.u.client.binary = p->binary;
+    rec.u.client.held = p->held;
+    if (send_with_fd(upfd, &rec, UPGRADE_SIZE(client), p->fd) < 0) {
+        return -1;
+    }
+
+    rec.type = UPGRADE_OUTPUT;
+    int offset = p->outq.offset;
+    for (struct out_chunk *c = p->outq.head; c != NULL; c = c->next) {
+        while (offset < c->msg->len) {
+            int len = c->msg->len - offset;
+            if (len > UPGRADE_CHUNK) {
+                len = UPGRADE_CHUNK;
+            }
+            rec.u.output.len = len;
+            memcpy(rec.u.output.data, c->msg->data + offset, len);
+            if (send_with_fd(upfd, &rec, offsetof(struct upgrade_rec, u.output.data) + len,
+                             -1) < 0) {
+                return -1;
+            }
+            offset += len;
+        }
+        offset = 0;
+    }
+    return 0;
+}
+
+/*
+ * Sends the listening sockets (localfd is -1 if there is no local one)
+ * and every room and client of every shard to a new process over upfd.
+ * The shards must be stopped. Returns 0 on success and -1 if the new
+ * process went away.
+ */
+int send_state(int upfd, int listenfd, int localfd) {
+    struct upgrade_rec rec;
+    int rooms = 0, clients = 0;
+
+    rec.type = UPGRADE_HELLO;
+    rec.u.hello.version = UPGRADE_VERSION;
+    rec.u.hello.size = sizeof(struct upgrade_rec);
+    if (send_with_fd(upfd, &rec, UPGRADE_SIZE(hello), listenfd) < 0) {
+        return -1;
+    }
+    rec.type = UPGRADE_LOCAL;
+    if (localfd != -1 && send_with_fd(upfd, &rec, sizeof(rec.type), localfd) < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < num_shards; i++) {
+        for (struct room *room = shards[i].rooms; room != NULL; room = room->next) {
+            struct game_state *game = &room->game;
+            // Nobody would notice an empty room going missing
+            if (room->num_clients == 0 && room->spectators == NULL) {
+                continue;
+            }
+
+            rec.type = UPGRADE_ROOM;
+            memcpy(rec.u.room.word, game->word, MAX_WORD);
+            rec.u.room.guessed = game->guessed;
+            rec.u.room.guesses_left = game->guesses_left;
+            rec.u.room.shard = -1;
+            for (struct client *p = game->head; p != NULL; p = p->next) {
+                if (p->held) {
+                    rec.u.room.shard = shards[i].id;
+                }
+            }
+            if (send_with_fd(upfd, &rec, UPGRADE_SIZE(room), -1) < 0) {
+                return -1;
+            }
+            rooms++;
+
+            for (struct client *p = game->head; p != NULL; p = p->next) {
+                // A held seat is sent without a connection, and keeps
+                // its token
+                if (send_client(upfd, p, p == game->has_next_turn) < 0) {
+                    return -1;
+                }
+                clients++;
+            }
+            for (struct client *p = room->new_players; p != NULL; p = p->next) {
+                if (send_client(upfd, p, 0) < 0) {
+                    return -1;
+                }
+                clients++;
+            }
+            for (struct client *p = room->spectators; p != NULL; p = p->next) {
+                if (send_client(upfd, p, 0) < 0) {
+                    return -1;
+                }
+                clients++;
+            }
+        }
+    }
+
+    rec.type = UPGRADE_END;
+    rec.u.end.rooms = rooms;
+    rec.u.end.clients = clients;
+    if (send_with_fd(upfd, &rec, UPGRADE_SIZE(end), -1) < 0) {
+        return -1;
+    }
+    log_msg(LOG_INFO, "Sent %d rooms and %d clients\n", rooms, clients);
+    return 0;
+}
+
+/*
+ * Closes every connection left in a shard's handoff pipe once the shards
+ * have stopped. A shard can send a connection on to another after that
+ * one has read its stop record, and the new process never sees it. A
+ * client that was resuming still has its seat held there, so it can
+ * reconnect and resume.
+ */
+void close_handoffs(void) {
+    struct handoff h;
+
+    for (int i = 0; i < num_shards; i++) {
+        while (read(shards[i].notify[0], &h, sizeof(h)) == sizeof(h)) {
+            if (h.fd != -1) {
+                log_msg(LOG_INFO, "Closing a connection that was moving to shard %d\n", i);
+                close(h.fd);
+            }
+        }
+    }
+}
+
+/*
+ * Hands everything over to the new process connected on upfd and exits.
+ * The shards are stopped first so that nothing changes while it is sent.
+ * If the new process does not confirm that it has taken over, the shards
+ * are started again and this process carries on serving.
+ */
+void hand_over(int upfd, int listenfd, int localfd) {
+    struct handoff stop;
+    char ack;
+
+    log_msg(LOG_INFO, "Handing over to a new process\n");
+    stop.fd = -1;
+    for (int i = 0; i < num_shards; i++) {
+        if (write(shards[i].notify[1], &stop, sizeof(stop)) != sizeof(stop)) {
+            perror("write to shard");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < num_shards; i++) {
+        pthread_join(shards[i].thread, NULL);
+    }
+
+    struct timeval tv = {UPGRADE_TIMEOUT, 0};
+    if (setsockopt(upfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+        perror("setsockopt");
+    }
+    if (send_state(upfd, listenfd, localfd) == 0 && read(upfd, &ack, 1) == 1) {
+        close_handoffs();
+        log_msg(LOG_INFO, "Handed over; exiting\n");
+        log_flush();
+        exit(0);
+    }
+
+    log_msg(LOG_ERROR, "Handover failed; carrying on\n");
+    for (int i = 0; i < num_shards; i++) {
+        shards[i].frozen = 0;
+        run_shard(&shards[i]);
+    }
+}
+
+/*
+ * Takes over the listening socket, rooms and clients of the running
+ * process connected on upfd, spreading the rooms over the shards, which
+ * must not be running yet. Returns the listening socket, and sets
+ * *localfd to the local one if the old process had one. Terminates with
+ * exit code 1 if the state is incomplete, leaving the old process to
+ * carry on.
+ */
+int receive_state(int upfd, int *localfd) {
+    struct upgrade_rec rec;
+    int fd;
+    int listenfd = -1;
+    int rooms = 0, clients = 0;
+    struct room *room = NULL;
+    struct client **players = NULL, **waiting = NULL;
+    struct client *last = NULL;
+
+    while (1) {
+        int n = recv_with_fd(upfd, &rec, sizeof(rec), &fd);
+        if (n <= 0) {
+            fprintf(stderr, "Upgrade: state ended early\n");
+            exit(1);
+        }
+
+        switch (rec.type) {
+        case UPGRADE_HELLO:
+            if (rec.u.hello.version != UPGRADE_VERSION ||
+                rec.u.hello.size != sizeof(struct upgrade_rec) || fd == -1) {
+                fprintf(stderr, "Upgrade: incompatible server version\n");
+                exit(1);
+            }
+            listenfd = fd;
+            break;
+
+        case UPGRADE_LOCAL:
+            if (fd == -1) {
+                fprintf(stderr, "Upgrade: local socket missing\n");
+                exit(1);
+            }
+            *localfd = fd;
+            break;
+
+        case UPGRADE_ROOM:
+            // Held seats can only be resumed in the shard their tokens
+            // name, so keep their room there if this process has it
+            if (rec.u.room.shard >= 0 && rec.u.room.shard < num_shards) {
+                room = new_room(&shards[rec.u.room.shard]);
+            } else {
+                room = new_room(least_loaded_shard());
+            }
+            resume_game(&room->game, rec.u.room.word, rec.u.room.guessed,
+                        rec.u.room.guesses_left);
+            players = &room->game.head;
+            waiting = &room->new_players;
+            last = NULL;
+            rooms++;
+            break;
+
+        case UPGRADE_CLIENT:
+            if (room == NULL || (fd == -1) != (rec.u.client.held == 1)) {
+                fprintf(stderr, "Upgrade: client outside a room\n");
+                exit(1);
+            }
+            // Append, so the turn order stays the same
+            if (rec.u.client.spectator) {
+                // Spectators take no seat and have no timer
+                add_player(&room->spectators, fd, rec.u.client.addr, room);
+                last = room->spectators;
+                last->spectator = 1;
+                room->num_clients--;
+                timer_cancel(&room->shard->timers, &last->idle);
+            } else if (rec.u.client.name[0] != '\0') {
+                add_player(players, fd, rec.u.client.addr, room);
+                last = *players;
+                players = &last->next;
+            } else {
+                add_player(waiting, fd, rec.u.client.addr, room);
+                last = *waiting;
+                waiting = &last->next;
+            }
+            __atomic_fetch_add(&room->shard->load, 1, __ATOMIC_RELAXED);
+            strcpy(last->name, rec.u.client.name);
+            if (last->name[0] != '\0') {
+                nameset_add(&room->game.names, last);
+                room->num_players++;
+            }
+            last->in = rec.u.client.in;
+            last->in.data = NULL;
+            if (last->in.start != last->in.end) {
+                last->in.data = pool_get(&room->shard->inbufs);
+                memcpy(last->in.data, rec.u.client.in_data, LINEBUF_SIZE);
+            }
+            last->binary = rec.u.client.binary;
+            // The token names the shard it was issued in, so a player who
+            // lands in another shard is given a new one
+            last->token = rec.u.client.token;
+            int moved = last->token != 0 &&
+                        (int)(last->token >> TOKEN_SHARD_SHIFT) != room->shard->id;
+            if (rec.u.client.held) {
+                // A held seat cannot be told a new token, so if its room
+                // had to move it is given up as soon as the shard starts,
+                // and the other players told as usual
+                if (moved) {
+                    log_msg(LOG_INFO, "Upgrade: giving up the held seat of %s, "
+                            "whose token names a shard that is gone\n", last->name);
+                }
+                hold_seat(last, moved ? 0 : grace_period * 1000UL);
+            } else {
+                if (moved) {
+                    issue_token(last);
+                }
+                arm_idle_timer(last);
+            }
+            if (rec.u.client.has_turn) {
+                room->game.has_next_turn = last;
+                start_turn_clock(room);
+            }
+            clients++;
+            break;
+
+        case UPGRADE_OUTPUT:
+            if (last == NULL || rec.u.output.len > UPGRADE_CHUNK) {
+                fprintf(stderr, "Upgrade: output without a client\n");
+                exit(1);
+            }
+            struct msg *m = msg_new(rec.u.output.data, rec.u.output.len);
+            outq_push(&last->outq, m);
+            msg_unref(m);
+            break;
+
+        case UPGRADE_END:
+            if (listenfd == -1 || rec.u.end.rooms != rooms ||
+                rec.u.end.clients != clients) {
+                fprintf(stderr, "Upgrade: state incomplete\n");
+                exit(1);
+            }
+            if (write(upfd, "", 1) != 1) {
+                perror("write");
+                exit(1);
+            }
+            log_msg(LOG_INFO, "Took over %d rooms and %d clients\n", rooms, clients);
+            return listenfd;
+
+        default:
+            fprintf(stderr, "Upgrade: unknown record %d\n", rec.type);
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Sends each client the output that was still queued for it when it was
+ * handed over. A room whose turn was held by a player who had dropped
+ * passes it to its first player, who is told so.
+ */
+void resume_output(void) {
+    for (int i = 0; i < num_shards; i++) {
+        for (struct room *room = shards[i].rooms; room != NULL; room = room->next) {
+            if (room->game.has_next_turn == NULL && room->game.head != NULL) {
+                room->game.has_next_turn = room->game.head;
+                announce_turn(&room->game);
+            }
+            for (struct client *p = room->game.head; p != NULL; p = p->next) {
+                if (p->outq.bytes > 0) {
+                    flush_client(p);
+                }
+            }
+            for (struct client *p = room->new_players; p != NULL; p = p->next) {
+                if (p->outq.bytes > 0) {
+                    flush_client(p);
+                }
+            }
+            for (struct client *p = room->spectators; p != NULL; p = p->next) {
+                if (p->outq.bytes > 0) {
+                    flush_client(p);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Passes the n accepted connections in batch to shard s in one write.
+ */
+void send_handoffs(struct shard *s, struct handoff *batch, int n) {
+    if (n == 0) {
+        return;
+    }
+    int len = n * sizeof(struct handoff);
+    if (write(s->notify[1], batch, len) != len) {
+        perror("write to shard");
+        for (int i = 0; i < n; i++) {
+            close(batch[i].fd);
+        }
+        __atomic_fetch_sub(&s->load, n, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Hands the connections waiting on listenfd, or those already accepted
+ * by ring if it is not NULL, to the shard with the fewest clients, a
+ * room's worth at a time so that consecutive players end up in the same
+ * game. The shard is charged for each client here, so a burst of
+ * connections is spread out before any of them reach their shards.
+ */
+void place_connections(int listenfd, struct uring *ring) {
+    // Kept between calls, so a room is filled across bursts
+    static struct shard *s = NULL;
+    static int placed = 0;
+    struct handoff batch[HANDOFF_BATCH];
+    int n = 0;
+    struct sockaddr_in q;
+    int fd;
+
+    /* Take every connection waiting, not just one, so a burst is
+     * cleared in a single wakeup. Connections bound for the same
+     * shard are passed on together.
+     */
+    while ((fd = (ring != NULL) ? accept_completed(ring, listenfd, &q)
+                                : accept_connection(listenfd, &q)) >= 0) {
+        if (recording) {
+            record_event(REC_CONNECT, fd, NULL, 0);
+        }
+        if (placed++ % room_size == 0) {
+            send_handoffs(s, batch, n);
+            n = 0;
+            s = least_loaded_shard();
+        }
+        __atomic_fetch_add(&s->load, 1, __ATOMIC_RELAXED);
+        batch[n].fd = fd;
+        batch[n].addr = q.sin_addr;
+        batch[n].token = 0;
+        batch[n].binary = 0;
+        batch[n].watch = 0;
+        if (++n == HANDOFF_BATCH) {
+            send_handoffs(s, batch, n);
+            n = 0;
+        }
+    }
+    send_handoffs(s, batch, n);
+}
+
+/*
+ * Starts a new period of accept counters in report.
+ */
+void start_accept_report(struct accept_report *report) {
+    report->start = (long)timer_now_ms();
+    report->accepted = accept_stats.accepted;
+    report->aborted = accept_stats.aborted;
+    report->shed = accept_stats.shed;
+    report->drops = listen_drops(report->listenfd);
+    report->max_depth = 0;
+}
+
+/*
+ * Returns the number of milliseconds until the accept counters in report
+ * are due to be printed.
+ */
+int accept_report_due(struct accept_report *report) {
+    long due = report->start + ACCEPT_REPORT_SECS * 1000L - (long)timer_now_ms();
+    return due > 0 ? due : 0;
+}
+
+/*
+ * Prints how fast connections were accepted since report was started,
+ * how deep the listen queue got, and how many connections were lost
+ * before or during accept, then starts a new period. Quiet periods are
+ * not printed.
+ */
+void print_accept_report(struct accept_report *report) {
+    long elapsed = (long)timer_now_ms() - report->start;
+    long accepted = accept_stats.accepted - report->accepted;
+    long drops = listen_drops(report->listenfd);
+    long dropped = (drops < 0 || report->drops < 0) ? 0 : drops - report->drops;
+
+    if (accepted > 0 || dropped > 0) {
+        log_msg(LOG_INFO, "Accepted %ld connections (%.1f/s), queue up to %d of %d, "
+                "%ld aborted, %ld shed, %ld dropped by the listen queue\n",
+                accepted, elapsed > 0 ? accepted * 1000.0 / elapsed : 0.0,
+                report->max_depth, backlog,
+                accept_stats.aborted - report->aborted,
+                accept_stats.shed - report->shed, dropped);
+    }
+    start_accept_report(report);
+}
+
+/*
+ * Signal handler for SIGUSR1.
+ */
+void handle_sigusr1(int sig) {
+    log_cycle_level();
+}
+
+
+int main(int argc, char **argv) {
+    // Handler for SIGPIPE
+    struct sigaction sa;
+    sa.sa_handler = SIG_IGN;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGPIPE, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    // SIGUSR1 makes the log more verbose, wrapping back to errors only
+    sa.sa_handler = handle_sigusr1;
+    sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGUSR1, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    int opt;
+    int verbosity = LOG_INFO;
+    int seeded = 0;
+    char *record_path = NULL;
+    int bad_backend = 0;
+    int num_workers = 0;
+    int worker = -1;
+    num_shards = -1;
+
+    while ((opt = getopt(argc, argv, "w:r:t:v:T:N:I:u:b:G:S:s:R:A:B:P:L:")) != -1) {
+        switch (opt) {
+        case 'w':
+            high_water = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            room_size = strtol(optarg, NULL, 10);
+            break;
+        case 't':
+            num_shards = strtol(optarg, NULL, 10);
+            break;
+        case 'v':
+            verbosity = strtol(optarg, NULL, 10);
+            break;
+        case 'T':
+            turn_timeout = strtol(optarg, NULL, 10);
+            break;
+        case 'N':
+            name_timeout = strtol(optarg, NULL, 10);
+            break;
+        case 'I':
+            idle_timeout = strtol(optarg, NULL, 10);
+            break;
+        case 'u':
+            upgrade_path = optarg;
+            break;
+        case 'b':
+            backlog = strtol(optarg, NULL, 10);
+            break;
+        case 'G':
+            grace_period = strtol(optarg, NULL, 10);
+            break;
+        case 'S':
+            watch_rate = strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            seeded = 1;
+            break;
+        case 'R':
+            record_path = optarg;
+            break;
+        case 'A':
+            admin_path = optarg;
+            break;
+        case 'B':
+            if (strcmp(optarg, "uring") == 0) {
+                use_uring = 1;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                use_uring = 0;
+            } else {
+                bad_backend = 1;
+            }
+            break;
+        case 'P':
+            num_workers = strtol(optarg, NULL, 10);
+            break;
+        case 'L':
+            local_path = optarg;
+            break;
+        default:
+            fprintf(stderr,"Usage: %s [-w high_water] [-r room_size] [-t threads] "
+                    "[-v verbosity] [-T turn_secs] [-N name_secs] [-I idle_secs] "
+                    "[-u upgrade_socket] [-b backlog] [-G grace_secs] [-S watch_rate]\n"
+                    "       [-s seed] [-R record_file] [-A admin_socket] [-B epoll|uring] [-P workers]\n"
+                    "       [-L local_socket] <dictionary filename>\n", argv[0]);
+            exit(1);
+        }
+    }
+    // Workers share the machine, so each gets one shard unless told
+    if (num_shards == -1) {
+        num_shards = num_workers > 0 ? 1 : sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(argc - optind != 1 || bad_backend || num_workers < 0 || high_water <= 0 || room_size <= 0 || num_shards <= 0 ||
+       backlog <= 0 ||
+       verbosity < LOG_ERROR || verbosity > LOG_DEBUG ||
+       turn_timeout < 0 || name_timeout < 0 || idle_timeout < 0 || grace_period < 0 ||
+       watch_rate <= 0 || watch_rate > 1000){
+        fprintf(stderr,"Usage: %s [-w high_water] [-r room_size] [-t threads] "
+                "[-v verbosity] [-T turn_secs] [-N name_secs] [-I idle_secs] "
+                "[-u upgrade_socket] [-b backlog] [-G grace_secs] [-S watch_rate]\n"
+                "       [-s seed] [-R record_file] [-A admin_socket] [-B epoll|uring] [-P workers]\n"
+                "       [-L local_socket] <dictionary filename>\n", argv[0]);
+        exit(1);
+    }
+
+    /* With -P this process only looks after the workers. Each worker goes
+     * on to run the rest of main as a complete server of its own, with its
+     * own listening socket on the shared port, and its own upgrade, admin,
+     * local and record files named by adding its index.
+     */
+    if (num_workers > 0) {
+        worker = supervise(num_workers);
+        char tag[16];
+        sprintf(tag, "[%d] ", worker);
+        log_set_prefix(tag);
+        upgrade_path = worker_path(upgrade_path, worker);
+        admin_path = worker_path(admin_path, worker);
+        local_path = worker_path(local_path, worker);
+        record_path = worker_path(record_path, worker);
+    }
+
+    /* SIGHUP reloads the dictionary. It is blocked before any thread is
+     * started, so that every thread inherits the mask and the signal is
+     * only ever picked up by the reloader through its signalfd.
+     */
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &hup, NULL) != 0) {
+        fprintf(stderr, "Could not block SIGHUP\n");
+        exit(1);
+    }
+    int sigfd = signalfd(-1, &hup, SFD_CLOEXEC);
+    if (sigfd < 0) {
+        perror("signalfd");
+        exit(1);
+    }
+    // A worker starts with SIGUSR1 blocked as well, so that one passed on
+    // by the supervisor waits until it can be handled
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    if (pthread_sigmask(SIG_UNBLOCK, &usr1, NULL) != 0) {
+        fprintf(stderr, "Could not unblock SIGUSR1\n");
+        exit(1);
+    }
+
+    log_start(verbosity);
+    started = clock_usec();
+
+    if (!seeded) {
+        seed = (unsigned int)time(NULL);
+    }
+    // Workers would otherwise all pick the same words
+    if (worker > 0) {
+        seed ^= worker * 0x27d4eb2du;
+    }
+    dictionary_path = argv[optind];
+    dictionary = malloc(sizeof(struct dictionary));
+    if (dictionary == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    load_dictionary(dictionary, dictionary_path);
+
+    raise_fd_limit();
+
+    shards = malloc(num_shards * sizeof(struct shard));
+    if (shards == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < num_shards; i++) {
+        init_shard(&shards[i], i);
+    }
+    if (record_path != NULL && record_open(record_path, seed, num_shards) < 0) {
+        exit(1);
+    }
+
+    /* If a server is already running with the same upgrade socket, take
+     * over its listening socket, games and players instead of starting
+     * afresh. Either way, listen there for the process that will one day
+     * take over from this one.
+     */
+    int listenfd = -1;
+    int localfd = -1;
+    int upgradefd = -1;
+    if (upgrade_path != NULL) {
+        int upfd = connect_upgrade_socket(upgrade_path);
+        if (upfd >= 0) {
+            listenfd = receive_state(upfd, &localfd);
+            close(upfd);
+        }
+        upgradefd = set_up_upgrade_socket(upgrade_path);
+    }
+    if (listenfd == -1) {
+        struct sockaddr_in *server = init_server_addr(PORT);
+        listenfd = set_up_server_socket(server, backlog, num_workers > 0);
+    } else {
+        // An inherited socket keeps its queue length unless it is resized
+        if (listen(listenfd, backlog) < 0) {
+            perror("listen");
+        }
+        if (fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK) < 0) {
+            perror("fcntl");
+        }
+    }
+    // An inherited local socket is kept only if one is still wanted
+    if (localfd != -1 && local_path == NULL) {
+        close(localfd);
+        localfd = -1;
+    }
+    if (localfd == -1 && local_path != NULL) {
+        localfd = set_up_local_socket(local_path, backlog);
+    }
+
+    resume_output();
+    for (int i = 0; i < num_shards; i++) {
+        run_shard(&shards[i]);
+    }
+    // Only once the shards are the only threads that pick words, since a
+    // reload waits for them alone before freeing the old dictionary; a
+    // SIGHUP in the meantime stays pending on sigfd
+    pthread_t reloader;
+    if (pthread_create(&reloader, NULL, reload_main, &sigfd) != 0) {
+        fprintf(stderr, "Could not start the dictionary reloader\n");
+        exit(1);
+    }
+    log_msg(LOG_INFO, "Serving with %d shards on %s, %d clients per room\n",
+            num_shards, use_uring ? "io_uring" : "epoll", room_size);
+
+    int adminfds[2] = {-1, listenfd};
+    if (admin_path != NULL) {
+        adminfds[0] = set_up_admin_socket(admin_path);
+        pthread_t admin;
+        if (pthread_create(&admin, NULL, admin_main, adminfds) != 0) {
+            fprintf(stderr, "Could not start the admin thread\n");
+            exit(1);
+        }
+    }
+
+    struct uring accept_uring;
+    struct uring *accept_ring = NULL;
+    // poll skips the sockets that are -1
+    struct pollfd fds[3] = {{listenfd, POLLIN, 0}, {upgradefd, POLLIN, 0},
+                            {localfd, POLLIN, 0}};
+    if (use_uring) {
+        // The ring accepts on its own, and is readable once it has
+        if (uring_init(&accept_uring, URING_ENTRIES / 4, 0) == 0) {
+            accept_ring = &accept_uring;
+            accept_multishot(accept_ring, listenfd);
+            uring_submit(accept_ring);
+            fds[0].fd = accept_ring->fd;
+        } else {
+            perror("io_uring for accepting");
+        }
+    }
+
+    struct accept_report report;
+    report.listenfd = listenfd;
+    start_accept_report(&report);
+    while (1) {
+        int ready = poll(fds, 3, accept_report_due(&report));
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+        // Checked on every wakeup, since under a steady stream of
+        // connections poll never times out
+        if (accept_report_due(&report) == 0) {
+            print_accept_report(&report);
+        }
+        if (ready == 0) {
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            int upfd = accept(upgradefd, NULL, NULL);
+            if (upfd >= 0) {
+                // Connections the ring has already accepted go to the
+                // shards before they stop; the rest wait in the queue
+                // for the new process
+                if (accept_ring != NULL) {
+                    accept_cancel(accept_ring);
+                    place_connections(listenfd, accept_ring);
+                }
+                hand_over(upfd, listenfd, localfd);
+                if (accept_ring != NULL) {
+                    accept_multishot(accept_ring, listenfd);
+                    uring_submit(accept_ring);
+                }
+                close(upfd);
+            }
+        }
+        // The ring only accepts on the TCP socket, so the local one is
+        // always accepted from directly
+        if (fds[2].revents & POLLIN) {
+            place_connections(localfd, NULL);
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int depth = listen_queue_depth(listenfd);
+        if (depth > report.max_depth) {
+            report.max_depth = depth;
+        }
+        place_connections(listenfd, accept_ring);
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dictfile.h"
+
+/*
+ * Compile a plain text dictionary (one word per line) into the binary
+ * format read by wordsrv and wheel, then print a summary of the result.
+ */
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <dictionary.txt> <output file>\n", argv[0]);
+        exit(1);
+    }
+    if (dict_compile(argv[1], argv[2]) < 0) {
+        exit(1);
+    }
+
+    struct dict_file d;
+    if (dict_open(&d, argv[2]) < 0) {
+        exit(1);
+    }
+    printf("%s: %u words, longest %u, %zu bytes\n", argv[2],
+           d.header->num_words, d.header->max_len, d.map_size);
+    dict_close(&d);
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dictfile.h"
+
+/*
+ * Return 1 if filename starts with the compiled dictionary magic, 0 if it
+ * does not (for example, a plain text word list) or cannot be read.
+ */
+int dict_is_compiled(const char *filename) {
+    char magic[4];
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    int compiled = (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+                    memcmp(magic, DICT_MAGIC, sizeof(magic)) == 0);
+    fclose(fp);
+    return compiled;
+}
+
+/*
+ * Check that the tables of the dictionary mapped at map, whose header
+ * ranges have been checked, only point inside it: every word starts
+ * after the one before and is no longer than max_len, the words end
+ * within the pool, the last with a null byte so that no word read as a
+ * string can run past it, and the length buckets stay within the words.
+ * Only the tables are read, not the words. Returns NULL if they are
+ * sound, and otherwise what is wrong.
+ */
+static const char *check_tables(const void *map) {
+    const struct dict_header *h = map;
+    const uint32_t *offsets = (const uint32_t *)((const char *)map + h->offsets_off);
+    const uint32_t *buckets = (const uint32_t *)((const char *)map + h->buckets_off);
+    const char *pool = (const char *)map + h->pool_off;
+
+    for (uint32_t i = 0; i < h->num_words; i++) {
+        // Each word takes at least its terminator
+        if (offsets[i + 1] <= offsets[i]) {
+            return "word offsets out of order";
+        }
+        if (offsets[i + 1] - offsets[i] - 1 > h->max_len) {
+            return "word longer than the longest word";
+        }
+    }
+    if (offsets[h->num_words] > h->pool_size ||
+        pool[offsets[h->num_words] - 1] != '\0') {
+        return "words run past the end of the pool";
+    }
+    for (uint32_t len = 0; len <= h->max_len; len++) {
+        if (buckets[len + 1] < buckets[len] || buckets[len + 1] > h->num_words) {
+            return "length buckets out of range";
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Map the compiled dictionary filename into d. The header and the tables
+ * are checked, so a truncated or corrupt file is refused rather than read
+ * out of bounds; the words themselves are used as they are in the file.
+ * Returns 0 on success, and -1 with a message on stderr if the file
+ * cannot be used.
+ */
+int dict_open(struct dict_file *d, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < sizeof(struct dict_header)) {
+        fprintf(stderr, "%s: too short to be a compiled dictionary\n", filename);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    const struct dict_header *h = map;
+    const char *problem = NULL;
+    if (memcmp(h->magic, DICT_MAGIC, sizeof(h->magic)) != 0) {
+        problem = "not a compiled dictionary";
+    } else if (h->version != DICT_VERSION) {
+        problem = "unsupported dictionary version";
+    } else if (h->byte_order != DICT_BYTE_ORDER) {
+        problem = "compiled on a host with a different byte order";
+    } else if (h->num_words == 0 ||
+               h->num_words > st.st_size / sizeof(uint32_t) ||
+               h->max_len > st.st_size / sizeof(uint32_t) ||
+               h->offsets_off % sizeof(uint32_t) != 0 ||
+               h->buckets_off % sizeof(uint32_t) != 0) {
+        problem = "truncated or corrupt";
+    } else if ((uint64_t)h->offsets_off + ((uint64_t)h->num_words + 1) * sizeof(uint32_t) >
+                   (uint64_t)st.st_size ||
+               (uint64_t)h->buckets_off + ((uint64_t)h->max_len + 2) * sizeof(uint32_t) >
+                   (uint64_t)st.st_size ||
+               (uint64_t)h->pool_off + h->pool_size > (uint64_t)st.st_size) {
+        // Sizes are worked out in 64 bits, so no header can wrap them
+        // round to something small enough to pass
+        problem = "truncated or corrupt";
+    } else {
+        problem = check_tables(map);
+    }
+    if (problem != NULL) {
+        fprintf(stderr, "%s: %s\n", filename, problem);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    d->header = h;
+    d->offsets = (const uint32_t *)((const char *)map + h->offsets_off);
+    d->buckets = (const uint32_t *)((const char *)map + h->buckets_off);
+    d->pool = (const char *)map + h->pool_off;
+    d->map_size = st.st_size;
+    return 0;
+}
+
+/*
+ * Unmap d.
+ */
+void dict_close(struct dict_file *d) {
+    munmap((void *)d->header, d->map_size);
+    d->header = NULL;
+}
+
+/*
+ * Write size bytes at buf to fp, returning -1 on failure.
+ */
+static int write_all(FILE *fp, const void *buf, size_t size) {
+    if (size > 0 && fwrite(buf, size, 1, fp) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Compile the word list src (one word per line) into a dictionary file at
+ * dst. Blank lines are skipped and DOS line endings are accepted. Returns
+ * 0 on success and -1 with a message on stderr on failure.
+ */
+int dict_compile(const char *src, const char *dst) {
+    FILE *in = fopen(src, "r");
+    if (in == NULL) {
+        perror(src);
+        return -1;
+    }
+
+    // First pass: collect the words and find the longest
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    char **words = NULL;
+    int *lens = NULL;
+    uint32_t num_words = 0, cap = 0, max_len = 0;
+    size_t pool_size = 0;
+
+    while ((len = getline(&line, &line_cap, in)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (num_words == cap) {
+            cap = cap ? cap * 2 : 1024;
+            words = realloc(words, cap * sizeof(char *));
+            lens = realloc(lens, cap * sizeof(int));
+            if (words == NULL || lens == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        words[num_words] = strdup(line);
+        if (words[num_words] == NULL) {
+            perror("strdup");
+            exit(1);
+        }
+        lens[num_words] = len;
+        if (len > max_len) {
+            max_len = len;
+        }
+        pool_size += len + 1;
+        num_words++;
+    }
+    free(line);
+    fclose(in);
+
+    if (num_words == 0) {
+        fprintf(stderr, "%s: no words\n", src);
+        free(words);
+        free(lens);
+        return -1;
+    }
+
+    // Count the words of each length, then turn the counts into the index
+    // of the first word of each length
+    uint32_t *buckets = calloc(max_len + 2, sizeof(uint32_t));
+    uint32_t *offsets = malloc((num_words + 1) * sizeof(uint32_t));
+    uint32_t *next = malloc((max_len + 1) * sizeof(uint32_t));
+    uint32_t *order = malloc(num_words * sizeof(uint32_t));
+    if (buckets == NULL || offsets == NULL || next == NULL || order == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < num_words; i++) {
+        buckets[lens[i] + 1]++;
+    }
+    for (uint32_t l = 1; l <= max_len + 1; l++) {
+        buckets[l] += buckets[l - 1];
+    }
+
+    // Stable placement by length keeps each bucket in file order
+    memcpy(next, buckets, (max_len + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_words; i++) {
+        order[next[lens[i]]++] = i;
+    }
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < num_words; i++) {
+        offsets[i] = pos;
+        pos += lens[order[i]] + 1;
+    }
+    offsets[num_words] = pos;
+
+    struct dict_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DICT_MAGIC, sizeof(h.magic));
+    h.version = DICT_VERSION;
+    h.byte_order = DICT_BYTE_ORDER;
+    h.num_words = num_words;
+    h.max_len = max_len;
+    h.offsets_off = sizeof(h);
+    h.buckets_off = h.offsets_off + (num_words + 1) * sizeof(uint32_t);
+    h.pool_off = h.buckets_off + (max_len + 2) * sizeof(uint32_t);
+    h.pool_size = pool_size;
+
+    // Write to a temporary name and rename, so that a running server
+    // never maps a half written file
+    char tmp[strlen(dst) + 5];
+    sprintf(tmp, "%s.tmp", dst);
+    FILE *out = fopen(tmp, "wb");
+    if (out == NULL) {
+        perror(tmp);
+        return -1;
+    }
+    int error = write_all(out, &h, sizeof(h)) ||
+                write_all(out, offsets, (num_words + 1) * sizeof(uint32_t)) ||
+                write_all(out, buckets, (max_len + 2) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_words && !error; i++) {
+        error = write_all(out, words[order[i]], lens[order[i]] + 1);
+    }
+    if (fclose(out) != 0 || error) {
+        perror(tmp);
+        unlink(tmp);
+        error = 1;
+    } else if (rename(tmp, dst) < 0) {
+        perror(dst);
+        unlink(tmp);
+        error = 1;
+    }
+
+    for (uint32_t i = 0; i < num_words; i++) {
+        free(words[i]);
+    }
+    free(words);
+    free(lens);
+    free(buckets);
+    free(offsets);
+    free(next);
+    free(order);
+    return error ? -1 : 0;
+}
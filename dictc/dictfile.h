@@ -0,0 +1,61 @@
+#ifndef _DICTFILE_H_
+#define _DICTFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A compiled dictionary is a single file that is mmap'd and used in place:
+ *
+ *     struct dict_header
+ *     uint32_t offsets[num_words + 1]   where each word starts in the pool;
+ *                                       offsets[num_words] is the pool size
+ *     uint32_t buckets[max_len + 2]     words of length L are the indices
+ *                                       buckets[L] up to buckets[L + 1]
+ *     char pool[pool_size]              the words, each null terminated,
+ *                                       sorted by length
+ *
+ * All integers are in host byte order; the header records which order
+ * that was so a file from another host is rejected instead of misread.
+ */
+
+#define DICT_MAGIC "WDCT"
+#define DICT_VERSION 1
+#define DICT_BYTE_ORDER 0x01020304
+
+struct dict_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_words;
+    uint32_t max_len;       // Length of the longest word
+    uint32_t offsets_off;   // File offset of the offsets table
+    uint32_t buckets_off;   // File offset of the length buckets
+    uint32_t pool_off;      // File offset of the string pool
+    uint32_t pool_size;
+};
+
+// An open compiled dictionary. Everything points into the mapping.
+struct dict_file {
+    const struct dict_header *header;
+    const uint32_t *offsets;
+    const uint32_t *buckets;
+    const char *pool;
+    size_t map_size;
+};
+
+int dict_is_compiled(const char *filename);
+int dict_open(struct dict_file *d, const char *filename);
+void dict_close(struct dict_file *d);
+int dict_compile(const char *src, const char *dst);
+
+/* Return word i of d. */
+static inline const char *dict_word(const struct dict_file *d, uint32_t i) {
+    return d->pool + d->offsets[i];
+}
+
+/* Return the length of word i of d. */
+static inline int dict_word_len(const struct dict_file *d, uint32_t i) {
+    return d->offsets[i + 1] - d->offsets[i] - 1;
+}
+
+#endif